@@ -1,4 +1,35 @@
-#import "serial_json_rpc.h"
+// Each demo below is built only with its library feature, uncomment what you need
+// or pass them as -D flags (host/Makefile FEATURES builds the virtual board with all of them).
+// The defaults fit the UNO R3, every feature costs RAM, see README.md "Built-in Methods".
+//
+// rpc.ping, rpc.echo, rpc.source, rpc.sink for `cli.py bench`
+// #define SERIAL_JSON_RPC_DIAGNOSTICS 1
+// per-method counters for `cli.py stats`
+// #define SERIAL_JSON_RPC_STATS 1
+// buffer and RAM high-water marks for `cli.py memory`
+// #define SERIAL_JSON_RPC_MEMORY_STATS 1
+// per-request stage timestamps for `cli.py trace`
+// #define SERIAL_JSON_RPC_TRACE 1
+// rpc.time for the host clock sync, `cli.py clock`
+// #define SERIAL_JSON_RPC_TIME 1
+// long-running handlers, see blink_builtin_led
+// #define SERIAL_JSON_RPC_JOBS 2
+// requests answered later from loop(), see watch_pin
+// #define SERIAL_JSON_RPC_DEFERRED 4
+// rpc.subscribe, see `cli.py subscribe`
+// #define SERIAL_JSON_RPC_SUBSCRIPTIONS 2
+// pin change events from the ISR, `cli.py events`
+// #define SERIAL_JSON_RPC_EVENTS 16
+// receive ring the Timer0 interrupt fills while a handler blocks, `cli.py rx`
+// #define SERIAL_JSON_RPC_RX_RING 128
+// queue room in every response, so pipelining clients never overflow the buffer
+// #define SERIAL_JSON_RPC_CREDIT 1
+// payloads over the request buffer in chunks, see page_checksum
+// #define SERIAL_JSON_RPC_UPLOAD 1
+// page_write bytes decoded into page_buffer while received
+// #define SERIAL_JSON_RPC_BYTE_SINKS 1
+
+#include "serial_json_rpc.h"
 
 using namespace SerialJsonRpcLibrary;
 
@@ -9,10 +40,97 @@ static const unsigned long SERIAL_BAUD = 115200;
 static SerialJsonRpcBoard rpc_board(rpc_processor);
 
 
+#if SERIAL_JSON_RPC_EVENTS
+// rpc.events types
+static const uint8_t EVENT_PIN_CHANGE = 1;
+static const uint8_t EVENT_BUILTIN_LED = 2;
+
+// INT0 on UNO R3
+static const uint8_t EVENT_PIN = 2;
+
+
+void pin_change_isr() {
+  rpc_board.push_event(EVENT_PIN_CHANGE, digitalRead(EVENT_PIN));
+}
+#endif
+
+
+#if SERIAL_JSON_RPC_JOBS
+// blink_builtin_led job state, one blink at a time
+struct BlinkJob {
+  bool running;
+  int toggles_left;
+  unsigned long next_toggle_ms;
+};
+
+static BlinkJob blink_job;
+
+static const unsigned long BLINK_HALF_PERIOD_MS = 100;
+
+
+bool blink_step(int request_id, void* ctx) {
+  BlinkJob* job = (BlinkJob*)ctx;
+  if ((long)(millis() - job->next_toggle_ms) < 0) {
+    return false;
+  }
+
+  int level = job->toggles_left % 2 ? LOW : HIGH;
+  digitalWrite(LED_BUILTIN, level);
+#if SERIAL_JSON_RPC_EVENTS
+  // the ISR is the other producer
+  noInterrupts();
+  rpc_board.push_event(EVENT_BUILTIN_LED, level);
+  interrupts();
+#endif
+  job->next_toggle_ms += BLINK_HALF_PERIOD_MS;
+  if (--job->toggles_left > 0) {
+    return false;
+  }
+
+  job->running = false;
+  rpc_board.send_result_string(request_id, F("OK: builtin LED blinked"));
+  return true;
+}
+#endif
+
+
+#if SERIAL_JSON_RPC_DEFERRED
+// watch_pin state, one watch at a time, answered from loop()
+struct PinWatch {
+  // defer() token, 0 when not watching
+  int token;
+  int request_id;
+  uint8_t pin;
+  int level;
+};
+
+static PinWatch pin_watch;
+#endif
+
+
+#if SERIAL_JSON_RPC_UPLOAD || SERIAL_JSON_RPC_BYTE_SINKS
+// e.g. one AT28C256 EEPROM page
+static const int PAGE_SIZE = 64;
+static uint8_t page_buffer[PAGE_SIZE];
+#endif
+
+
+#if SERIAL_JSON_RPC_UPLOAD
+// upload sink, the page is written once complete
+bool page_sink(unsigned long offset, const uint8_t* data, int size) {
+  if (offset + size > PAGE_SIZE) {
+    return false;
+  }
+  memcpy(page_buffer + offset, data, size);
+  return true;
+}
+#endif
+
+
 void rpc_processor(int request_id, const String &method, const String params[], int params_size) {
-  if (method == "set_builtin_led") {
+  if (SerialJsonRpcBoard::is_method(method, F("set_builtin_led"))) {
     if (params_size != 1) {
-      rpc_board.send_error(request_id, -32602, "Invalid params", "params_size != 1");
+      rpc_board.send_error(request_id, -32602, F("Invalid params"), F("params_size != 1"));
       return;
     }
 
@@ -21,19 +139,118 @@ void rpc_processor(int request_id, const String &method, const String params[],
     pinMode(LED_BUILTIN, OUTPUT);
     digitalWrite(LED_BUILTIN, status ? HIGH : LOW);
 
-    rpc_board.send_result_string(request_id, status ? "OK: builtin LED is ON" : "OK: builtin LED is OFF");
+    rpc_board.send_result_string(request_id, status ? F("OK: builtin LED is ON") : F("OK: builtin LED is OFF"));
+
+#if SERIAL_JSON_RPC_JOBS
+  } else if (SerialJsonRpcBoard::is_method(method, F("blink_builtin_led"))) {
+    // answers once done, other requests are served while it blinks
+    int count = params_size == 1 ? atoi(params[0].c_str()) : 0;
+    if (count < 1 || count > 100) {
+      rpc_board.send_error(request_id, -32602, F("Invalid params"), F("expected count 1..100"));
+      return;
+    }
+    if (blink_job.running) {
+      rpc_board.send_error(request_id, -32603, F("Internal error"), F("already blinking"));
+      return;
+    }
+
+    pinMode(LED_BUILTIN, OUTPUT);
+    blink_job.toggles_left = 2 * count;
+    blink_job.next_toggle_ms = millis();
+    blink_job.running = rpc_board.start_job(request_id, blink_step, &blink_job);
+#endif
+
+#if SERIAL_JSON_RPC_DEFERRED
+  } else if (SerialJsonRpcBoard::is_method(method, F("watch_pin"))) {
+    // answers with the new level once the pin changes, the library times it out
+    if (params_size != 2) {
+      rpc_board.send_error(request_id, -32602, F("Invalid params"), F("params_size != 2"));
+      return;
+    }
+    if (pin_watch.token) {
+      rpc_board.send_error(request_id, -32603, F("Internal error"), F("already watching"));
+      return;
+    }
+
+    pin_watch.pin = atoi(params[0].c_str());
+    pin_watch.level = digitalRead(pin_watch.pin);
+    pin_watch.request_id = request_id;
+    pin_watch.token = rpc_board.defer(request_id, strtoul(params[1].c_str(), 0, 10));
+#endif
+
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  } else if (SerialJsonRpcBoard::is_method(method, F("page_write"))) {
+    // the bytes are in page_buffer already, unless queued behind another page_write
+    long size = rpc_board.byte_sink_size();
+    if (size < 0) {
+      size = params_size == 1 ? SerialJsonRpcBoard::json_array_to_bytes(params[0], page_buffer, PAGE_SIZE) : -1;
+    }
+    if (size < 0) {
+      rpc_board.send_error(request_id, -32602, F("Invalid params"), F("expected up to 64 bytes"));
+      return;
+    }
+
+    long result[] = {size, 0};
+    for (long i = 0; i < size; i++) {
+      result[1] += page_buffer[i];
+    }
+    rpc_board.send_result_longs(request_id, result, 2);
+#endif
+
+#if SERIAL_JSON_RPC_UPLOAD
+  } else if (SerialJsonRpcBoard::is_method(method, F("page_checksum"))) {
+    // the page comes with rpc.upload_begin / rpc.upload_chunk, the handle is the last param
+    long size = params_size == 1 ? rpc_board.upload_size(atol(params[0].c_str())) : -1;
+    if (size < 0) {
+      rpc_board.send_error(request_id, -32602, F("Invalid params"), F("expected a complete upload handle"));
+      return;
+    }
+
+    long result[] = {size, 0};
+    for (long i = 0; i < size; i++) {
+      result[1] += page_buffer[i];
+    }
+    rpc_board.send_result_longs(request_id, result, 2);
+#endif
 
   } else {
-    rpc_board.send_error(request_id, -32601, "Method not found", method.c_str());
+    rpc_board.send_error(request_id, -32601, F("Method not found"), method.c_str());
   }
 }
 
 
 void setup() {
-  Serial.begin(SERIAL_BAUD);
+  // the client waits for its rpc.ready
+  rpc_board.init(SERIAL_BAUD);
+
+#if SERIAL_JSON_RPC_EVENTS
+  pinMode(EVENT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(EVENT_PIN), pin_change_isr, CHANGE);
+#endif
+
+#if SERIAL_JSON_RPC_UPLOAD
+  rpc_board.set_upload_sink(page_sink, PAGE_SIZE);
+#endif
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  rpc_board.set_byte_sink("page_write", 0, page_buffer, PAGE_SIZE);
+#endif
 }
 
 
 void loop() {
   rpc_board.loop();
+
+#if SERIAL_JSON_RPC_DEFERRED
+  if (pin_watch.token) {
+    int level = digitalRead(pin_watch.pin);
+    if (!rpc_board.is_deferred(pin_watch.token)) {
+      // timed out
+      pin_watch.token = 0;
+    } else if (level != pin_watch.level && rpc_board.answer_deferred(pin_watch.token)) {
+      long result = level;
+      rpc_board.send_result_longs(pin_watch.request_id, &result, 1);
+      pin_watch.token = 0;
+    }
+  }
+#endif
 }
@@ -4,6 +4,113 @@
 #include <limits.h>
 #include <ArduinoJson.h>
 
+// request buffer size, shared by all queued requests
+// 350 is a balance between the protocol throughput and the UNO R3 memory limit,
+// boards with more RAM can go higher, see rpc.memory
+#ifndef SERIAL_JSON_RPC_BUFFER_SIZE
+#define SERIAL_JSON_RPC_BUFFER_SIZE 350
+#endif
+
+// max number of complete requests buffered while a handler runs
+// all queued requests share the same _JSON_RPC_BUFFER_SIZE bytes
+#ifndef SERIAL_JSON_RPC_QUEUE_SIZE
+#define SERIAL_JSON_RPC_QUEUE_SIZE 4
+#endif
+
+// built-in link diagnostics: rpc.ping, rpc.echo, rpc.source, rpc.sink
+#ifndef SERIAL_JSON_RPC_DIAGNOSTICS
+#define SERIAL_JSON_RPC_DIAGNOSTICS 0
+#endif
+
+// per-method call counters served by rpc.stats
+#ifndef SERIAL_JSON_RPC_STATS
+#define SERIAL_JSON_RPC_STATS 0
+#endif
+
+// number of distinct methods rpc.stats keeps counters for
+#ifndef SERIAL_JSON_RPC_STATS_METHODS
+#define SERIAL_JSON_RPC_STATS_METHODS 8
+#endif
+
+// buffer, JSON document, heap and stack high-water marks served by rpc.memory
+#ifndef SERIAL_JSON_RPC_MEMORY_STATS
+#define SERIAL_JSON_RPC_MEMORY_STATS 0
+#endif
+
+// per-request micros() timestamps of every processing stage served by rpc.trace
+#ifndef SERIAL_JSON_RPC_TRACE
+#define SERIAL_JSON_RPC_TRACE 0
+#endif
+
+// number of the latest requests rpc.trace keeps
+#ifndef SERIAL_JSON_RPC_TRACE_SIZE
+#define SERIAL_JSON_RPC_TRACE_SIZE 4
+#endif
+
+// rpc.time for the host clock sync, see py-cli ClockSync
+#ifndef SERIAL_JSON_RPC_TIME
+#define SERIAL_JSON_RPC_TIME 0
+#endif
+
+// max number of jobs running at once, see start_job(), 0 disables jobs
+#ifndef SERIAL_JSON_RPC_JOBS
+#define SERIAL_JSON_RPC_JOBS 0
+#endif
+
+// loop() time given to job steps, in microseconds
+#ifndef SERIAL_JSON_RPC_JOB_BUDGET_US
+#define SERIAL_JSON_RPC_JOB_BUDGET_US 2000
+#endif
+
+// max number of requests answered after their handler returned, see defer(), 0 disables it
+#ifndef SERIAL_JSON_RPC_DEFERRED
+#define SERIAL_JSON_RPC_DEFERRED 0
+#endif
+
+// max number of rpc.subscribe subscriptions at once, 0 disables them
+#ifndef SERIAL_JSON_RPC_SUBSCRIPTIONS
+#define SERIAL_JSON_RPC_SUBSCRIPTIONS 0
+#endif
+
+// event ring size for push_event(), a power of two up to 128, 0 disables events
+#ifndef SERIAL_JSON_RPC_EVENTS
+#define SERIAL_JSON_RPC_EVENTS 0
+#endif
+
+// library-owned RX ring size, a power of two up to 32768, 0 reads Serial directly
+// on AVR the Timer0 compare interrupt moves bytes from the 64-byte Serial buffer into it every ~1 ms,
+// so handlers and Serial.flush() can take longer than the ~5.5 ms the Serial buffer lasts at 115200,
+// Serial must not be read by the sketch then
+#ifndef SERIAL_JSON_RPC_RX_RING
+#define SERIAL_JSON_RPC_RX_RING 0
+#endif
+
+// responses carry "credit":[free_slots, free_bytes], the queue room left for the requests sent after them,
+// the client never sends beyond it
+#ifndef SERIAL_JSON_RPC_CREDIT
+#define SERIAL_JSON_RPC_CREDIT 0
+#endif
+
+// rpc.upload_begin and rpc.upload_chunk stage payloads larger than the buffer into a sketch sink,
+// see set_upload_sink()
+#ifndef SERIAL_JSON_RPC_UPLOAD
+#define SERIAL_JSON_RPC_UPLOAD 0
+#endif
+
+// max number of byte array params decoded straight into sketch buffers while received, see set_byte_sink()
+#ifndef SERIAL_JSON_RPC_BYTE_SINKS
+#define SERIAL_JSON_RPC_BYTE_SINKS 0
+#endif
+
+// per-request RX timestamps, internal
+#define SERIAL_JSON_RPC_RX_TIMESTAMPS (SERIAL_JSON_RPC_TRACE || SERIAL_JSON_RPC_TIME)
+
+#if SERIAL_JSON_RPC_MEMORY_STATS && defined(__AVR__)
+// avr-libc heap bounds
+extern char* __brkval;
+extern char __heap_start;
+#endif
+
 namespace SerialJsonRpcLibrary {
 
 enum JsonRpcErrorCode : short {
@@ -29,7 +136,8 @@ class SerialJsonRpcBoard {
 public:
   SerialJsonRpcBoard(RpcProcessor rpc_processor);
 
-  void init();
+  // opens Serial and sends the rpc.ready notification, clients start right after it
+  void init(unsigned long baudrate = _DEFAULT_BAUDRATE);
   void loop();
 
   void send_result_string(int id, const char* string);
@@ -37,140 +145,989 @@ public:
   void send_result_longs(int id, long* buffer, size_t buffer_size);
   void send_error(int id, int error_code, const char* error_message, const char* error_data);
 
+  // F() strings stay in flash, e.g. send_error(id, -32602, F("Invalid params"), F("params_size != 1"))
+  void send_result_string(int id, const __FlashStringHelper* string);
+  void send_error(int id, int error_code, const __FlashStringHelper* error_message, const __FlashStringHelper* error_data);
+  void send_error(int id, int error_code, const __FlashStringHelper* error_message, const char* error_data);
+
   // helpers
+  // decodes an array of up to capacity numbers 0..255, returns their count or -1 for anything else
+  static long json_array_to_bytes(const String& raw_json, uint8_t* bytes, size_t capacity);
+  // returns 0 for anything json_array_to_bytes() rejects, an empty array included
+  __attribute__((deprecated("use json_array_to_bytes(), it tells an empty array from an invalid one")))
   static size_t json_array_to_byte_array(const String& raw_json, uint8_t* byte_array, size_t array_size);
+  // method == name without the name in RAM, e.g. is_method(method, F("set_builtin_led"))
+  static bool is_method(const String& method, const __FlashStringHelper* name);
+
+#if SERIAL_JSON_RPC_JOBS
+  // request_id, ctx; true once the job is finished and has sent the response
+  using JobStep = bool (*)(int, void*);
+
+  // lets a handler return without a response, loop() then calls step() until it returns true,
+  // between the requests and within SERIAL_JSON_RPC_JOB_BUDGET_US per loop(),
+  // each step must be short, ctx must outlive the job
+  // answers the request with an error and returns false when SERIAL_JSON_RPC_JOBS are running
+  bool start_job(int id, JobStep step, void* ctx);
+  int jobs_running() const;
+#endif
+
+#if SERIAL_JSON_RPC_RX_RING
+  // moves the received bytes into the ring, called from the Timer0 compare interrupt on AVR
+  static void rx_ring_isr();
+#endif
+
+#if SERIAL_JSON_RPC_EVENTS
+  // queues an event for the rpc.events notification, lock-free and safe to call from ISRs,
+  // micros() of the call is kept with it
+  // single producer: call it from ISRs that don't nest, or from the sketch with interrupts off
+  // returns false and counts the event as dropped when the ring is full
+  bool push_event(uint8_t type, uint16_t value);
+#endif
+
+#if SERIAL_JSON_RPC_DEFERRED
+  // keeps the request open after the handler returns and returns its token, the sketch answers it later
+  // in any order with the other requests; loop() answers it with INTERNAL_ERROR after timeout_ms
+  // answers with an error and returns 0 when SERIAL_JSON_RPC_DEFERRED requests are open
+  int defer(int id, unsigned long timeout_ms);
+  // false once answered or expired
+  bool is_deferred(int token) const;
+  // closes the request of token, true when it was open and the caller must send its answer with send_*,
+  // false when it has expired and is answered already
+  bool answer_deferred(int token);
+#endif
+
+#if SERIAL_JSON_RPC_UPLOAD
+  // offset, data, size; false rejects the chunk and aborts the upload
+  using UploadSink = bool (*)(unsigned long, const uint8_t*, int);
+
+  // rpc.upload_begin(size) starts an upload of up to max_size bytes and returns [handle],
+  // rpc.upload_chunk(handle, offset, bytes) passes the chunks to sink in order,
+  // the sketch method then takes the handle as a param, one upload at a time
+  void set_upload_sink(UploadSink sink, unsigned long max_size);
+  // the uploaded size once all bytes of the handle upload reached the sink, -1 otherwise
+  long upload_size(long handle) const;
+#endif
+
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  // decodes the param_index param of method, an array of 0..255, into buffer as it is received,
+  // its text is never buffered and the handler gets "0" for it, see byte_sink_size()
+  // a request queued behind another one of the method comes as text, so buffer is only written
+  // while no request of the method is queued; needs "method" before "params" in the request
+  // returns false when SERIAL_JSON_RPC_BYTE_SINKS are set
+  bool set_byte_sink(const char* method, int param_index, uint8_t* buffer, size_t capacity);
+  // bytes decoded into the sink for the current request, -1 when the param came as text
+  // for json_array_to_bytes()
+  long byte_sink_size() const;
+#endif
+
+#ifdef SERIAL_JSON_RPC_BENCH
+  // host/bench/board_bench.cpp times the private stages
+  friend struct BoardBench;
+#endif
 
 private:
   // default baudrate
   static const unsigned long _DEFAULT_BAUDRATE = 115200;
 
-  // balance between the protocol throughput and the board memory limit
-  // works fine for UNO R3
-  static const int _JSON_RPC_BUFFER_SIZE = 350;
+  // see SERIAL_JSON_RPC_BUFFER_SIZE
+  static const int _JSON_RPC_BUFFER_SIZE = SERIAL_JSON_RPC_BUFFER_SIZE;
 
   // use \n for simiplicity to use both py-client and Arduino Serial Monitor
   static const char _END_OF_JSON_RPC_MESSAGE = '\n';
 
+  // pipelining depth, see SERIAL_JSON_RPC_QUEUE_SIZE
+  static const int _JSON_RPC_QUEUE_SIZE = SERIAL_JSON_RPC_QUEUE_SIZE;
+
+  // rpc.source response limit, keeps both response documents within UNO R3 heap
+  static const int _DIAGNOSTICS_SOURCE_MAX_SIZE = 64;
+
+  // subscribed method name and JSON params, both with \0
+  static const int _SUBSCRIPTION_REQUEST_SIZE = 48;
+
+  // "credit" member and its 2 elements
+  static const int _CREDIT_SIZE = SERIAL_JSON_RPC_CREDIT ? JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(2) : 0;
+
+  // rpc.upload_chunk bytes per chunk, 4 JSON chars each at most
+  static const int _UPLOAD_CHUNK_MAX_SIZE = 64;
+
+  // byte sink method name with \0, longer names never match
+  static const int _BYTE_SINK_METHOD_SIZE = 24;
+
+  // events per rpc.events notification
+  static const int _EVENTS_BATCH_SIZE = 8;
+
+  // rpc.trace("bin") records per response, 54 bytes stay under the rpc.source limit
+  static const int _TRACE_BINARY_RECORDS = 3;
+  // int32 id, uint32 first_byte_us, 5 uint16 stage deltas
+  static const int _TRACE_BINARY_RECORD_SIZE = 18;
+  // TraceRecord::reached bits, micros() is 0 after boot and at every wrap so no stage value can mean "not reached"
+  static const uint8_t _TRACE_PARSED = 1 << 0;
+  static const uint8_t _TRACE_HANDLED = 1 << 1;
+  static const uint8_t _TRACE_SERIALIZED = 1 << 2;
+  static const uint8_t _TRACE_SENT = 1 << 3;
+
+  void _receive();
+  int _rx_available();
+  char _rx_read();
+  void _run_jobs();
+  void _expire_deferred();
+  void _process_next_request();
+  static size_t _request_capacity(const char* json, int length);
+  void _dequeue_request();
   void _process_request(JsonDocument& request);
+  void _call_method(int request_id, const String& method, JsonArray params_json_array);
+  bool _process_builtin_request(int request_id, const String& method, const String params[], int params_size);
+
+  template <typename T>
+  void _send_result_string(int id, T string, size_t string_length);
+  template <typename TMessage, typename TData>
+  void _send_error(int id, int error_code, TMessage error_message, TData error_data, size_t strings_length);
 
   DynamicJsonDocument _get_response(int id, int data_size);
   void _send_response(DynamicJsonDocument &response);
+  size_t _serialize_response(DynamicJsonDocument &response);
+  void _run_subscriptions();
+  void _send_events();
+
+#if SERIAL_JSON_RPC_CREDIT
+  void _add_credit(DynamicJsonDocument &response);
+
+  // the oldest queued request is being processed, it leaves the queue after its response
+  bool processing_request;
+#endif
+
+#if SERIAL_JSON_RPC_STATS
+  struct MethodStats {
+    // FNV-1a of the method name
+    uint32_t method_hash;
+    unsigned long calls;
+    unsigned long errors;
+    unsigned long total_us;
+    unsigned long max_us;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+  };
+
+  static uint32_t _method_hash(const char* method);
+  void _stats_begin_call(const String& method);
+  void _stats_end_call(unsigned long start_us);
+  void _send_stats(int request_id, const String params[], int params_size);
+
+  MethodStats method_stats[SERIAL_JSON_RPC_STATS_METHODS];
+  int method_stats_count;
+  // counters of the running handler, 0 outside of handlers or when the table is full
+  MethodStats* current_method_stats;
+  // size of the request being processed, with the terminator
+  int current_request_bytes;
+
+  // loop() counters
+  unsigned long stats_requests;
+  unsigned long stats_parse_errors;
+  unsigned long stats_overflows;
+  unsigned long stats_invalid_requests;
+  unsigned long stats_untracked_calls;
+#endif
+
+  // no-ops without SERIAL_JSON_RPC_MEMORY_STATS
+  void _track_document(const JsonDocument& document);
+  void _track_stack();
+
+#if SERIAL_JSON_RPC_JOBS
+  struct Job {
+    // 0 for a free slot
+    JobStep step;
+    void* ctx;
+    int request_id;
+  };
+
+  Job jobs[SERIAL_JSON_RPC_JOBS];
+  // round robin, the slot to step first
+  int jobs_next;
+#endif
+
+#if SERIAL_JSON_RPC_DEFERRED
+  struct DeferredRequest {
+    // 0 for a free slot, client ids can repeat so the slot is found by its token
+    int token;
+    int id;
+    unsigned long deadline_ms;
+  };
+
+  DeferredRequest deferred_requests[SERIAL_JSON_RPC_DEFERRED];
+  int deferred_last_token;
+#endif
+
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  struct Subscription {
+    // 0 for a free slot
+    int id;
+    unsigned long period_ms;
+    unsigned long next_ms;
+    // method name, \0, JSON params array, \0
+    char request[_SUBSCRIPTION_REQUEST_SIZE];
+  };
+
+  void _subscribe(int request_id, const String params[], int params_size);
+  void _unsubscribe(int request_id, const String params[], int params_size);
+  void _sample_subscription(Subscription& subscription);
+  size_t _serialize_notification(DynamicJsonDocument &response);
+
+  Subscription subscriptions[SERIAL_JSON_RPC_SUBSCRIPTIONS];
+  int subscription_last_id;
+  // micros() when the current sample was taken
+  unsigned long subscription_sample_us;
+  // subscription whose method is being called, its responses go out as notifications; 0 otherwise
+  int sampling_subscription;
+#endif
+
+#if SERIAL_JSON_RPC_RX_RING
+  static_assert(SERIAL_JSON_RPC_RX_RING <= 32768 && (SERIAL_JSON_RPC_RX_RING & (SERIAL_JSON_RPC_RX_RING - 1)) == 0,
+                "SERIAL_JSON_RPC_RX_RING must be a power of two up to 32768");
+
+#if SERIAL_JSON_RPC_RX_RING > 256
+  typedef uint16_t RxRingIndex;
+#else
+  typedef uint8_t RxRingIndex;
+#endif
+
+  void _rx_ring_start();
+  void _rx_ring_fill();
+  RxRingIndex _rx_ring_head();
+  void _send_rx_stats(int request_id);
+
+  // the instance the ISR fills
+  static SerialJsonRpcBoard* rx_ring_board;
+
+  // single producer, single consumer: rx_ring_head is only written by _rx_ring_fill(),
+  // rx_ring_tail only by _rx_read(), the loop side accesses the 16-bit ones with interrupts off
+  uint8_t rx_ring[SERIAL_JSON_RPC_RX_RING];
+  volatile RxRingIndex rx_ring_head;
+  volatile RxRingIndex rx_ring_tail;
+  // written by the ISR only
+  volatile RxRingIndex rx_ring_high_water;
+  // times bytes had to stay in the Serial buffer as the ring was full
+  volatile unsigned long rx_ring_full;
+  // times the Serial buffer was found full, bytes were likely lost
+  volatile unsigned long rx_serial_overruns;
+#endif
+
+#if SERIAL_JSON_RPC_UPLOAD
+  void _upload_begin(int request_id, const String params[], int params_size);
+  void _upload_chunk(int request_id, const String params[], int params_size);
+
+  UploadSink upload_sink;
+  unsigned long upload_max_size;
+  // 0 when no upload is open
+  long upload_handle;
+  long upload_last_handle;
+  unsigned long upload_expected_size;
+  unsigned long upload_received_size;
+#endif
+
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  struct ByteSink {
+    const char* method;
+    int param_index;
+    uint8_t* buffer;
+    size_t capacity;
+    // queued requests of the method
+    uint8_t queued;
+  };
+
+  // depth-1 keys of the request object the scanner looks for
+  enum ScanKey : uint8_t {
+    SCAN_KEY_OTHER,
+    SCAN_KEY_METHOD,
+    SCAN_KEY_PARAMS
+  };
+
+  // false when c goes to a sink instead of the buffer, c becomes "0" at the end of the sink array
+  bool _scan_char(char& c);
+  void _scan_string_end();
+  void _scan_flush_number();
+  void _scan_reset();
+
+  // request_queue_byte_sink_sizes of a param that came as text and of an invalid array
+  static const int _BYTE_SINK_TEXT = -2;
+  static const int _BYTE_SINK_INVALID = -1;
+
+  ByteSink byte_sinks[SERIAL_JSON_RPC_BYTE_SINKS];
+  int byte_sinks_count;
+
+  // JSON scanner of the partially received request
+  uint8_t scan_depth;
+  bool scan_in_string;
+  bool scan_escape;
+  // a depth-1 string after a colon is a value, a key otherwise
+  bool scan_value;
+  ScanKey scan_key;
+  // the depth-1 string, _BYTE_SINK_METHOD_SIZE length once truncated
+  char scan_string[_BYTE_SINK_METHOD_SIZE];
+  uint8_t scan_string_length;
+  bool scan_in_params;
+  int scan_param_index;
+  // byte sink of the method, -1 for none
+  int8_t scan_sink;
+  bool scan_streaming;
+  bool scan_error;
+  // number being decoded, -1 between numbers
+  int scan_number;
+  size_t scan_count;
+
+  // the partial request array went to the scan_sink buffer
+  bool scan_streamed;
+  int partial_byte_sink_size;
+  // byte sink of the method, -1 for none, and the array size of every queued request
+  int8_t request_queue_byte_sinks[_JSON_RPC_QUEUE_SIZE];
+  int request_queue_byte_sink_sizes[_JSON_RPC_QUEUE_SIZE];
+  int current_byte_sink_size;
+#endif
+
+#if SERIAL_JSON_RPC_EVENTS
+  static_assert(SERIAL_JSON_RPC_EVENTS <= 128 && (SERIAL_JSON_RPC_EVENTS & (SERIAL_JSON_RPC_EVENTS - 1)) == 0,
+                "SERIAL_JSON_RPC_EVENTS must be a power of two up to 128");
+
+  struct Event {
+    uint8_t type;
+    uint16_t value;
+    unsigned long time_us;
+  };
+
+  // single producer, single consumer: events_head is only written by push_event(),
+  // events_tail only by loop(), single byte indices are atomic on AVR
+  Event events[SERIAL_JSON_RPC_EVENTS];
+  volatile uint8_t events_head;
+  volatile uint8_t events_tail;
+  // wrapping counters, the difference is not reported yet
+  volatile uint8_t events_dropped;
+  uint8_t events_dropped_reported;
+#endif
+
+#if SERIAL_JSON_RPC_TRACE
+  struct TraceRecord {
+    long id;
+    // micros() when loop() read the first byte and the terminator,
+    // parsing finished, the handler passed its response on,
+    // the response was serialized and Serial.flush() returned,
+    // a stage is valid only once its _TRACE_* bit is set in reached
+    unsigned long first_byte_us;
+    unsigned long terminator_us;
+    unsigned long parsed_us;
+    unsigned long handled_us;
+    unsigned long serialized_us;
+    unsigned long sent_us;
+    uint8_t reached;
+  };
+
+  void _send_trace(int request_id, const String params[], int params_size);
+  const TraceRecord& _trace_record(int index);
+
+  // the latest requests, trace_count % SERIAL_JSON_RPC_TRACE_SIZE is the next slot
+  TraceRecord trace_records[SERIAL_JSON_RPC_TRACE_SIZE];
+  unsigned long trace_count;
+  // request being processed, committed to the ring once done
+  // so rpc.trace never returns itself half-filled
+  TraceRecord current_trace;
+  bool trace_active;
+#endif
+
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+  // micros() when loop() read the first byte and the terminator
+  // of the queued requests, the first byte of the partial one
+  unsigned long request_queue_first_byte_us[_JSON_RPC_QUEUE_SIZE];
+  unsigned long request_queue_terminator_us[_JSON_RPC_QUEUE_SIZE];
+  unsigned long partial_request_first_byte_us;
+  // terminator of the request being processed
+  unsigned long current_request_rx_us;
+#endif
+
+#if SERIAL_JSON_RPC_MEMORY_STATS
+  static long _free_ram();
+  void _send_memory(int request_id);
+
+  int rx_buffer_high_water;
+  int request_queue_high_water;
+  size_t document_capacity_high_water;
+  size_t document_usage_high_water;
+  unsigned long allocation_failures;
+  unsigned long document_overflows;
+  // -1 when unknown on the platform
+  long free_ram_low_water;
+  long stack_high_water;
+#endif
 
   int baudrate;
 
   RpcProcessor rpc_processor_callback;
 
+  // complete requests are stored back to back from the buffer start,
+  // followed by the partially received one
   char serial_read_buffer[_JSON_RPC_BUFFER_SIZE];
   int serial_read_buffer_pos;
+  // the rest of an overflowed request is dropped up to its terminator
+  bool discarding_request;
+
+  // lengths of the complete requests, oldest first
+  int request_queue_lengths[_JSON_RPC_QUEUE_SIZE];
+  int request_queue_count;
+  // bytes taken by the complete requests
+  int request_queue_bytes;
 };
 
 SerialJsonRpcBoard::SerialJsonRpcBoard(RpcProcessor rpc_processor)
-  : rpc_processor_callback(rpc_processor), serial_read_buffer_pos(0) {}
+  : rpc_processor_callback(rpc_processor), serial_read_buffer_pos(0), discarding_request(false),
+    request_queue_count(0), request_queue_bytes(0) {
+#if SERIAL_JSON_RPC_CREDIT
+  processing_request = false;
+#endif
+#if SERIAL_JSON_RPC_STATS
+  memset(method_stats, 0, sizeof(method_stats));
+  method_stats_count = 0;
+  current_method_stats = 0;
+  current_request_bytes = 0;
+  stats_requests = stats_parse_errors = stats_overflows = stats_invalid_requests = stats_untracked_calls = 0;
+#endif
+#if SERIAL_JSON_RPC_MEMORY_STATS
+  rx_buffer_high_water = 0;
+  request_queue_high_water = 0;
+  document_capacity_high_water = 0;
+  document_usage_high_water = 0;
+  allocation_failures = 0;
+  document_overflows = 0;
+  free_ram_low_water = -1;
+  stack_high_water = -1;
+#endif
+#if SERIAL_JSON_RPC_JOBS
+  memset(jobs, 0, sizeof(jobs));
+  jobs_next = 0;
+#endif
+#if SERIAL_JSON_RPC_DEFERRED
+  memset(deferred_requests, 0, sizeof(deferred_requests));
+  deferred_last_token = 0;
+#endif
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  memset(subscriptions, 0, sizeof(subscriptions));
+  subscription_last_id = 0;
+  subscription_sample_us = 0;
+  sampling_subscription = 0;
+#endif
+#if SERIAL_JSON_RPC_RX_RING
+  rx_ring_head = rx_ring_tail = 0;
+  rx_ring_high_water = 0;
+  rx_ring_full = rx_serial_overruns = 0;
+#endif
+#if SERIAL_JSON_RPC_UPLOAD
+  upload_sink = 0;
+  upload_max_size = 0;
+  upload_handle = upload_last_handle = 0;
+  upload_expected_size = upload_received_size = 0;
+#endif
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  byte_sinks_count = 0;
+  _scan_reset();
+  current_byte_sink_size = _BYTE_SINK_TEXT;
+#endif
+#if SERIAL_JSON_RPC_EVENTS
+  events_head = events_tail = 0;
+  events_dropped = events_dropped_reported = 0;
+#endif
+#if SERIAL_JSON_RPC_TRACE
+  memset(trace_records, 0, sizeof(trace_records));
+  trace_count = 0;
+  trace_active = false;
+#endif
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+  partial_request_first_byte_us = 0;
+  current_request_rx_us = 0;
+#endif
+}
+
+void SerialJsonRpcBoard::init(unsigned long baudrate) {
+  Serial.begin(baudrate);
+#if SERIAL_JSON_RPC_RX_RING
+  _rx_ring_start();
+#endif
 
-void SerialJsonRpcBoard::init() {
-  Serial.begin(_DEFAULT_BAUDRATE);
+  // {"jsonrpc":"2.0","method":"rpc.ready","params":{"buffer_size":350,"queue_size":4}}
+  Serial.print(F("{\"jsonrpc\":\"2.0\",\"method\":\"rpc.ready\",\"params\":{\"buffer_size\":"));
+  Serial.print(_JSON_RPC_BUFFER_SIZE);
+  Serial.print(F(",\"queue_size\":"));
+  Serial.print(_JSON_RPC_QUEUE_SIZE);
+  Serial.print(F("}}"));
+  Serial.write(_END_OF_JSON_RPC_MESSAGE);
+  Serial.flush();
 }
 
 void SerialJsonRpcBoard::loop() {
-  // read data by char if any
-  while (Serial.available()) {
-    char c = (char)Serial.read();
+  // buffer everything that arrived, so the host can keep sending
+  // while the oldest request is processed
+  _receive();
 
-    if (c == _END_OF_JSON_RPC_MESSAGE) {
-      DynamicJsonDocument request(serial_read_buffer_pos);
-      DeserializationError deserialization_error = deserializeJson(request, serial_read_buffer, serial_read_buffer_pos);
-      if (deserialization_error) {
-        const char* error_data = deserialization_error.c_str();
-        send_error(0, JsonRpcErrorCode::PARSE_ERROR, "Parse error", error_data);
-      } else {
-        _process_request(request);
-      }
-      request.clear();
-      request.garbageCollect();
-      serial_read_buffer_pos = 0;
+  // long-running handlers, see start_job()
+  _run_jobs();
+
+  // deferred requests nobody answered, see defer()
+  _expire_deferred();
+
+  // due rpc.subscribe samples
+  _run_subscriptions();
+
+  // events queued by push_event()
+  _send_events();
+
+  // process one request per loop
+  if (request_queue_count > 0) {
+    _process_next_request();
+  }
+}
+
+#if SERIAL_JSON_RPC_JOBS
+bool SerialJsonRpcBoard::start_job(int id, JobStep step, void* ctx) {
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  // its response would go out after the sample, as a response
+  if (sampling_subscription) {
+    send_error(id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("jobs can't be subscribed"));
+    return false;
+  }
+#endif
+  for (int i = 0; i < SERIAL_JSON_RPC_JOBS; i++) {
+    if (!jobs[i].step) {
+      jobs[i].step = step;
+      jobs[i].ctx = ctx;
+      jobs[i].request_id = id;
+      return true;
+    }
+  }
+  send_error(id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("too many jobs"));
+  return false;
+}
+
+int SerialJsonRpcBoard::jobs_running() const {
+  int running = 0;
+  for (int i = 0; i < SERIAL_JSON_RPC_JOBS; i++) {
+    if (jobs[i].step) {
+      running++;
+    }
+  }
+  return running;
+}
+#endif
+
+#if SERIAL_JSON_RPC_DEFERRED
+int SerialJsonRpcBoard::defer(int id, unsigned long timeout_ms) {
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  // its response would go out after the sample, as a response
+  if (sampling_subscription) {
+    send_error(id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("deferred requests can't be subscribed"));
+    return 0;
+  }
+#endif
+  for (int i = 0; i < SERIAL_JSON_RPC_DEFERRED; i++) {
+    if (!deferred_requests[i].token) {
+      // positive, never 0
+      deferred_last_token = deferred_last_token < INT_MAX ? deferred_last_token + 1 : 1;
+      deferred_requests[i].token = deferred_last_token;
+      deferred_requests[i].id = id;
+      deferred_requests[i].deadline_ms = millis() + timeout_ms;
+      return deferred_last_token;
+    }
+  }
+  send_error(id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("too many deferred requests"));
+  return 0;
+}
+
+bool SerialJsonRpcBoard::is_deferred(int token) const {
+  for (int i = 0; i < SERIAL_JSON_RPC_DEFERRED; i++) {
+    if (token && deferred_requests[i].token == token) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SerialJsonRpcBoard::answer_deferred(int token) {
+  for (int i = 0; i < SERIAL_JSON_RPC_DEFERRED; i++) {
+    if (token && deferred_requests[i].token == token) {
+      deferred_requests[i].token = 0;
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+void SerialJsonRpcBoard::_expire_deferred() {
+#if SERIAL_JSON_RPC_DEFERRED
+  unsigned long now_ms = millis();
+  for (int i = 0; i < SERIAL_JSON_RPC_DEFERRED; i++) {
+    if (deferred_requests[i].token && (long)(now_ms - deferred_requests[i].deadline_ms) >= 0) {
+      deferred_requests[i].token = 0;
+      send_error(deferred_requests[i].id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("deferred response timeout"));
+    }
+  }
+#endif
+}
+
+void SerialJsonRpcBoard::_run_jobs() {
+#if SERIAL_JSON_RPC_JOBS
+  unsigned long start_us = micros();
+  int idle_slots = 0;
+
+  // step the jobs in turns until the budget is spent or no job is left
+  while (idle_slots < SERIAL_JSON_RPC_JOBS && micros() - start_us < SERIAL_JSON_RPC_JOB_BUDGET_US) {
+    Job& job = jobs[jobs_next];
+    jobs_next = (jobs_next + 1) % SERIAL_JSON_RPC_JOBS;
+    if (!job.step) {
+      idle_slots++;
+      continue;
+    }
+    idle_slots = 0;
+
+    if (job.step(job.request_id, job.ctx)) {
+      job.step = 0;
+    }
+
+    // keep the HW RX buffer drained between steps
+    _receive();
+  }
+#endif
+}
+
+int SerialJsonRpcBoard::_rx_available() {
+#if SERIAL_JSON_RPC_RX_RING
+#if defined(__AVR__)
+  // sketches calling Serial.begin() themselves
+  _rx_ring_start();
+#else
+  // no timer interrupt, filled from the loop
+  _rx_ring_fill();
+#endif
+  return (RxRingIndex)(_rx_ring_head() - rx_ring_tail) & (SERIAL_JSON_RPC_RX_RING - 1);
+#else
+  return Serial.available();
+#endif
+}
+
+char SerialJsonRpcBoard::_rx_read() {
+#if SERIAL_JSON_RPC_RX_RING
+  RxRingIndex tail = rx_ring_tail;
+  char c = (char)rx_ring[tail];
+  // the byte is read before its slot is released
+  __asm__ __volatile__("" ::: "memory");
+  tail = (tail + 1) & (SERIAL_JSON_RPC_RX_RING - 1);
+#if SERIAL_JSON_RPC_RX_RING > 256 && defined(__AVR__)
+  // the ISR must not see half of the new tail
+  uint8_t sreg = SREG;
+  cli();
+  rx_ring_tail = tail;
+  SREG = sreg;
+#else
+  rx_ring_tail = tail;
+#endif
+  return c;
+#else
+  return (char)Serial.read();
+#endif
+}
+
+void SerialJsonRpcBoard::_receive() {
+  // read data by char if any and there is a free queue slot
+  while (request_queue_count < _JSON_RPC_QUEUE_SIZE && _rx_available()) {
+    // buffer is full of queued requests, keep the rest in the HW buffer
+    if (serial_read_buffer_pos >= _JSON_RPC_BUFFER_SIZE && request_queue_bytes > 0) {
       return;
     }
 
+    char c = _rx_read();
+
+    if (discarding_request) {
+      // the overflow error is already sent
+      if (c == _END_OF_JSON_RPC_MESSAGE) {
+        discarding_request = false;
+      }
+      continue;
+    }
+
+    if (c == _END_OF_JSON_RPC_MESSAGE) {
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+      unsigned long now_us = micros();
+      // empty request, the terminator is its first byte
+      request_queue_first_byte_us[request_queue_count] =
+        serial_read_buffer_pos > request_queue_bytes ? partial_request_first_byte_us : now_us;
+      request_queue_terminator_us[request_queue_count] = now_us;
+#endif
+#if SERIAL_JSON_RPC_BYTE_SINKS
+      request_queue_byte_sinks[request_queue_count] = scan_sink;
+      request_queue_byte_sink_sizes[request_queue_count] = scan_streamed ? partial_byte_sink_size : _BYTE_SINK_TEXT;
+      if (scan_sink >= 0) {
+        byte_sinks[scan_sink].queued++;
+      }
+      _scan_reset();
+#endif
+      request_queue_lengths[request_queue_count++] = serial_read_buffer_pos - request_queue_bytes;
+      request_queue_bytes = serial_read_buffer_pos;
+#if SERIAL_JSON_RPC_MEMORY_STATS
+      if (request_queue_count > request_queue_high_water) {
+        request_queue_high_water = request_queue_count;
+      }
+#endif
+      continue;
+    }
+
+#if SERIAL_JSON_RPC_BYTE_SINKS
+    // array bytes go to the sink, not to the buffer
+    if (!_scan_char(c)) {
+      continue;
+    }
+#endif
+
     // buffer overflow
     if (serial_read_buffer_pos >= _JSON_RPC_BUFFER_SIZE) {
-      send_error(0, JsonRpcErrorCode::INVALID_REQUEST, "Invalid Request", "JSON RPC message is to large");
-      serial_read_buffer_pos = 0;
-      return;
+#if SERIAL_JSON_RPC_STATS
+      stats_overflows++;
+#endif
+#if SERIAL_JSON_RPC_BYTE_SINKS
+      _scan_reset();
+#endif
+      // drop the partial request first, so the error credit counts its bytes as free
+      serial_read_buffer_pos = request_queue_bytes;
+      discarding_request = true;
+      send_error(0, JsonRpcErrorCode::INVALID_REQUEST, F("Invalid Request"), F("JSON RPC message is to large"));
+      continue;
+    }
+
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+    if (serial_read_buffer_pos == request_queue_bytes) {
+      partial_request_first_byte_us = micros();
     }
+#endif
 
     // read next char
     serial_read_buffer[serial_read_buffer_pos++] = c;
+#if SERIAL_JSON_RPC_MEMORY_STATS
+    if (serial_read_buffer_pos > rx_buffer_high_water) {
+      rx_buffer_high_water = serial_read_buffer_pos;
+    }
+#endif
+  }
+}
+
+void SerialJsonRpcBoard::_process_next_request() {
+  // the oldest request always starts at the buffer start
+  int request_length = request_queue_lengths[0];
+  if (request_length == 0) {
+    // a blank line, e.g. from the Serial Monitor, is no request
+    _dequeue_request();
+    return;
+  }
+#if SERIAL_JSON_RPC_STATS
+  stats_requests++;
+  current_request_bytes = request_length + 1;
+#endif
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+  current_request_rx_us = request_queue_terminator_us[0];
+#endif
+#if SERIAL_JSON_RPC_TRACE
+  memset(&current_trace, 0, sizeof(current_trace));
+  current_trace.first_byte_us = request_queue_first_byte_us[0];
+  current_trace.terminator_us = request_queue_terminator_us[0];
+  trace_active = true;
+#endif
+#if SERIAL_JSON_RPC_CREDIT
+  processing_request = true;
+#endif
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  current_byte_sink_size = request_queue_byte_sink_sizes[0];
+#endif
+
+  DynamicJsonDocument request(_request_capacity(serial_read_buffer, request_length));
+  DeserializationError deserialization_error = deserializeJson(request, serial_read_buffer, request_length);
+  _track_document(request);
+#if SERIAL_JSON_RPC_TRACE
+  current_trace.parsed_us = micros();
+  current_trace.reached |= _TRACE_PARSED;
+#endif
+  if (deserialization_error) {
+#if SERIAL_JSON_RPC_STATS
+    stats_parse_errors++;
+#endif
+    const char* error_data = deserialization_error.c_str();
+    send_error(0, JsonRpcErrorCode::PARSE_ERROR, F("Parse error"), error_data);
+  } else {
+    _process_request(request);
+  }
+  request.clear();
+  request.garbageCollect();
+
+#if SERIAL_JSON_RPC_TRACE
+  if (trace_active) {
+    trace_records[trace_count % SERIAL_JSON_RPC_TRACE_SIZE] = current_trace;
+    trace_count++;
+    trace_active = false;
+  }
+#endif
+
+  _dequeue_request();
+#if SERIAL_JSON_RPC_CREDIT
+  processing_request = false;
+#endif
+}
+
+// the request is parsed in place, so its strings stay in serial_read_buffer
+// and the pool only holds a slot per member and element, each opened by { or [ or follows a comma
+size_t SerialJsonRpcBoard::_request_capacity(const char* json, int length) {
+  size_t slots = 0;
+  bool in_string = false;
+  for (int i = 0; i < length; i++) {
+    char c = json[i];
+    if (in_string) {
+      if (c == '\\') {
+        i++;
+      } else if (c == '"') {
+        in_string = false;
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == ',' || c == '[' || c == '{') {
+      slots++;
+    }
+  }
+  // a scalar takes no slot, but a 0 capacity reads as a failed malloc() in rpc.memory
+  return JSON_ARRAY_SIZE(slots > 0 ? slots : 1);
+}
+
+void SerialJsonRpcBoard::_dequeue_request() {
+  int request_length = request_queue_lengths[0];
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  // the handler is done with the sink buffer
+  if (request_queue_byte_sinks[0] >= 0) {
+    byte_sinks[request_queue_byte_sinks[0]].queued--;
   }
+  current_byte_sink_size = _BYTE_SINK_TEXT;
+#endif
+
+  // move the rest of the queue and the partial request to the buffer start
+  memmove(serial_read_buffer, serial_read_buffer + request_length, serial_read_buffer_pos - request_length);
+  serial_read_buffer_pos -= request_length;
+  request_queue_bytes -= request_length;
+
+  for (int i = 1; i < request_queue_count; i++) {
+    request_queue_lengths[i - 1] = request_queue_lengths[i];
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+    request_queue_first_byte_us[i - 1] = request_queue_first_byte_us[i];
+    request_queue_terminator_us[i - 1] = request_queue_terminator_us[i];
+#endif
+#if SERIAL_JSON_RPC_BYTE_SINKS
+    request_queue_byte_sinks[i - 1] = request_queue_byte_sinks[i];
+    request_queue_byte_sink_sizes[i - 1] = request_queue_byte_sink_sizes[i];
+#endif
+  }
+  request_queue_count--;
 }
 
 void SerialJsonRpcBoard::send_result_string(int id, const char* string) {
-  // >"result":< == 9
-  // string len + "" (2)
-  int data_size = 9 + strlen(string) + 2;
-  DynamicJsonDocument response = _get_response(id, data_size);
+  _send_result_string(id, string, strlen(string));
+}
 
-  DynamicJsonDocument result(data_size);
-  JsonVariant result_data = result.to<JsonVariant>();
-  result_data.set(String(string));
-  response["result"] = result_data;
+void SerialJsonRpcBoard::send_result_string(int id, const __FlashStringHelper* string) {
+  _send_result_string(id, string, strlen_P((PGM_P)string));
+}
+
+template <typename T>
+void SerialJsonRpcBoard::_send_result_string(int id, T string, size_t string_length) {
+  // flash strings are copied into the document
+  DynamicJsonDocument response = _get_response(id, JSON_STRING_SIZE(string_length));
+  response["result"] = string;
 
   _send_response(response);
 }
 
 void SerialJsonRpcBoard::send_result_bytes(int id, uint8_t* buffer, size_t buffer_size) {
-  // >"result":< == 9
-  // max byte = 255 + comma separator + space == 4
-  // array braces = [] == 2
-  int data_size = 9 + 2 + 4 * buffer_size;
-  DynamicJsonDocument response = _get_response(id, data_size);
-
-  DynamicJsonDocument result(data_size);
-  JsonArray arr = result.to<JsonArray>();
-  for (int i = 0; i < buffer_size; i ++) {
+  // a slot per element
+  DynamicJsonDocument response = _get_response(id, JSON_ARRAY_SIZE(buffer_size));
+  JsonArray arr = response.createNestedArray("result");
+  for (size_t i = 0; i < buffer_size; i++) {
     arr.add(buffer[i]);
   }
-  response["result"] = result;
 
   _send_response(response);
 }
 
 void SerialJsonRpcBoard::send_result_longs(int id, long* buffer, size_t buffer_size) {
-  // >"result":< == 9
-  // max byte = minus + 10 digits + comma separator + space == 13
-  // array braces = [] == 2
-  int data_size = 9 + 2 + 13 * buffer_size;
-  DynamicJsonDocument response = _get_response(id, data_size);
-
-  DynamicJsonDocument result(data_size);
-  JsonArray arr = result.to<JsonArray>();
-  for (int i = 0; i < buffer_size; i ++) {
+  // a slot per element
+  DynamicJsonDocument response = _get_response(id, JSON_ARRAY_SIZE(buffer_size));
+  JsonArray arr = response.createNestedArray("result");
+  for (size_t i = 0; i < buffer_size; i++) {
     arr.add(buffer[i]);
   }
-  response["result"] = result;
 
   _send_response(response);
 }
 
-size_t SerialJsonRpcBoard::json_array_to_byte_array(const String& raw_json, uint8_t* byte_array, size_t array_size) {
-  DynamicJsonDocument json_doc(raw_json.length());
-  deserializeJson(json_doc, raw_json);
+long SerialJsonRpcBoard::json_array_to_bytes(const String& raw_json, uint8_t* bytes, size_t capacity) {
+  // the pool is sized by the element count, the commas of an array of numbers give it
+  size_t count = 0;
+  bool empty = true;
+  for (unsigned int i = 0; i < raw_json.length(); i++) {
+    char c = raw_json[i];
+    if (c == ',') {
+      count++;
+    } else if (c != '[' && c != ']' && c != ' ') {
+      empty = false;
+    }
+  }
+  count = empty ? 0 : count + 1;
+  if (count > capacity) {
+    return -1;
+  }
+
+  DynamicJsonDocument json_doc(JSON_ARRAY_SIZE(count));
+  if (deserializeJson(json_doc, raw_json)) {
+    return -1;
+  }
+  // anything but count numbers of 0..255 decodes to another count or type
   JsonArray json_array = json_doc.as<JsonArray>();
-  if (json_array.size() > array_size) {
-    return 0;
+  if (json_array.isNull() || json_array.size() != count) {
+    return -1;
   }
-  for (size_t i = 0; i < json_array.size(); i++) {
-    byte_array[i] = json_array[i].as<uint8_t>();
+  for (size_t i = 0; i < count; i++) {
+    if (!json_array[i].is<uint8_t>()) {
+      return -1;
+    }
+    bytes[i] = json_array[i].as<uint8_t>();
   }
-  return json_array.size();
+  return count;
+}
+
+size_t SerialJsonRpcBoard::json_array_to_byte_array(const String& raw_json, uint8_t* byte_array, size_t array_size) {
+  long size = json_array_to_bytes(raw_json, byte_array, array_size);
+  return size < 0 ? 0 : size;
 }
 
 void SerialJsonRpcBoard::send_error(int id, int error_code, const char* error_message, const char* error_data) {
+  _send_error(id, error_code, error_message, error_data, strlen(error_message) + (error_data != 0 ? strlen(error_data) : 0));
+}
+
+void SerialJsonRpcBoard::send_error(int id, int error_code, const __FlashStringHelper* error_message, const __FlashStringHelper* error_data) {
+  // flash strings are copied into the document, +1 for each terminator
+  _send_error(id, error_code, error_message, error_data,
+              strlen_P((PGM_P)error_message) + 1 + (error_data != 0 ? strlen_P((PGM_P)error_data) + 1 : 0));
+}
+
+void SerialJsonRpcBoard::send_error(int id, int error_code, const __FlashStringHelper* error_message, const char* error_data) {
+  _send_error(id, error_code, error_message, error_data,
+              strlen_P((PGM_P)error_message) + 1 + (error_data != 0 ? strlen(error_data) : 0));
+}
+
+bool SerialJsonRpcBoard::is_method(const String& method, const __FlashStringHelper* name) {
+  return strcmp_P(method.c_str(), (PGM_P)name) == 0;
+}
+
+template <typename TMessage, typename TData>
+void SerialJsonRpcBoard::_send_error(int id, int error_code, TMessage error_message, TData error_data, size_t strings_length) {
   // {"jsonrpc":"2.0","id":-,"error":{"code":-,"message":"","data":""}}
-  // base lenght is 66
-  // +10 for ID (max signed 32 len)
-  // +10 for error_code
-  // 86 in total
-  DynamicJsonDocument response(86 + strlen(error_message) + strlen(error_data));
+  // a slot per member, the literals are linked, the copied strings take strings_length
+  DynamicJsonDocument response(JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(3) + strings_length + _CREDIT_SIZE);
   response["jsonrpc"] = "2.0";
   response["id"] = id;
 
@@ -181,63 +1138,985 @@ void SerialJsonRpcBoard::send_error(int id, int error_code, const char* error_me
     error["data"] = error_data;
   }
 
-  serializeJson(response, Serial);
-  response.clear();
-  response.garbageCollect();
+#if SERIAL_JSON_RPC_STATS
+  if (current_method_stats) {
+    current_method_stats->errors++;
+  }
+#endif
 
-  Serial.write(_END_OF_JSON_RPC_MESSAGE);
-  Serial.flush();
+  _send_response(response);
 }
 
 void SerialJsonRpcBoard::_process_request(JsonDocument& request) {
   // validata JSON RPC format
-  if (!request.containsKey("jsonrpc") || strcmp(request["jsonrpc"], "2.0") != 0) {
-    send_error(0, JsonRpcErrorCode::INVALID_REQUEST, "Invalid Request", "Invalid protocol version");
+  if (!request.containsKey("jsonrpc") || strcmp(request["jsonrpc"] | "", "2.0") != 0) {
+#if SERIAL_JSON_RPC_STATS
+    stats_invalid_requests++;
+#endif
+    send_error(0, JsonRpcErrorCode::INVALID_REQUEST, F("Invalid Request"), F("Invalid protocol version"));
     return;
   }
 
   int request_id = request.containsKey("id") ? request["id"].as<int>() : 0;
+#if SERIAL_JSON_RPC_TRACE
+  current_trace.id = request_id;
+#endif
 
   const String method = request["method"] | "";
   JsonVariant params = request["params"];
 
   if (!params.is<JsonArray>()) {
-    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, "Invalid params", "Array expected");
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("Array expected"));
     return;
   }
 
+  _call_method(request_id, method, params.as<JsonArray>());
+}
+
+void SerialJsonRpcBoard::_call_method(int request_id, const String& method, JsonArray params_json_array) {
   // convert JsonArray to const String[]
-  JsonArray params_json_array = params.as<JsonArray>();
   const size_t params_size = params_json_array.size();
   String params_array[params_size];
   for (size_t i = 0; i < params_size; i++) {
     params_array[i] = params_json_array[i].as<String>();
   }
 
-  rpc_processor_callback(request_id, method, params_array, params_size);
+#if SERIAL_JSON_RPC_BYTE_SINKS
+  if (current_byte_sink_size == _BYTE_SINK_INVALID) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("expected an array of 0..255 within the sink capacity"));
+    return;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_STATS
+  _stats_begin_call(method);
+  unsigned long start_us = micros();
+#endif
+
+  // built-in methods go through the same conversion and response paths as the user ones
+  if (!_process_builtin_request(request_id, method, params_array, params_size)) {
+    rpc_processor_callback(request_id, method, params_array, params_size);
+  }
+
+#if SERIAL_JSON_RPC_STATS
+  _stats_end_call(start_us);
+#endif
+}
+
+bool SerialJsonRpcBoard::_process_builtin_request(int request_id, const String& method, const String params[], int params_size) {
+  if (strncmp_P(method.c_str(), PSTR("rpc."), 4) != 0) {
+    return false;
+  }
+
+#if SERIAL_JSON_RPC_DIAGNOSTICS
+  // minimum round trip
+  if (is_method(method, F("rpc.ping"))) {
+    send_result_string(request_id, F("pong"));
+    return true;
+  }
+
+  // string param back as is
+  if (is_method(method, F("rpc.echo"))) {
+    if (params_size != 1) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("params_size != 1"));
+      return true;
+    }
+    send_result_string(request_id, params[0].c_str());
+    return true;
+  }
+
+  // downlink: n bytes back
+  if (is_method(method, F("rpc.source"))) {
+    long size = params_size == 1 ? params[0].toInt() : -1;
+    if (size < 0 || size > _DIAGNOSTICS_SOURCE_MAX_SIZE) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("expected size 0..64"));
+      return true;
+    }
+    uint8_t buffer[_DIAGNOSTICS_SOURCE_MAX_SIZE];
+    for (long i = 0; i < size; i++) {
+      buffer[i] = (uint8_t)i;
+    }
+    send_result_bytes(request_id, buffer, size);
+    return true;
+  }
+
+  // uplink: accepts a byte array, answers with its size
+  if (is_method(method, F("rpc.sink"))) {
+    if (params_size != 1) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("params_size != 1"));
+      return true;
+    }
+    uint8_t buffer[_JSON_RPC_BUFFER_SIZE / 2];
+    long size = json_array_to_bytes(params[0], buffer, sizeof(buffer));
+    if (size < 0) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("expected an array of 0..255"));
+      return true;
+    }
+    send_result_longs(request_id, &size, 1);
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_TIME
+  // clock sync sample: [rx_us, tx_us], micros() when the request terminator was read
+  // and when the response is about to be sent, see py-cli ClockSync
+  if (is_method(method, F("rpc.time"))) {
+    long result[] = {(long)current_request_rx_us, (long)micros()};
+    send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_MEMORY_STATS
+  if (is_method(method, F("rpc.memory"))) {
+    _send_memory(request_id);
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_TRACE
+  if (is_method(method, F("rpc.trace"))) {
+    // not traced, reading the ring doesn't push records out of it
+    trace_active = false;
+    _send_trace(request_id, params, params_size);
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  if (is_method(method, F("rpc.subscribe"))) {
+    _subscribe(request_id, params, params_size);
+    return true;
+  }
+  if (is_method(method, F("rpc.unsubscribe"))) {
+    _unsubscribe(request_id, params, params_size);
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_RX_RING
+  if (is_method(method, F("rpc.rx"))) {
+    _send_rx_stats(request_id);
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_UPLOAD
+  if (is_method(method, F("rpc.upload_begin"))) {
+    _upload_begin(request_id, params, params_size);
+    return true;
+  }
+  if (is_method(method, F("rpc.upload_chunk"))) {
+    _upload_chunk(request_id, params, params_size);
+    return true;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_STATS
+  if (is_method(method, F("rpc.stats"))) {
+    _send_stats(request_id, params, params_size);
+    return true;
+  }
+#endif
+
+  // unknown rpc.* methods are left to the sketch
+  return false;
 }
 
 DynamicJsonDocument SerialJsonRpcBoard::_get_response(int id, int data_size) {
-  // {"jsonrpc":"2.0","id":}
-  // base lenght is 24
-  // +10 for ID (max signed 32 len)
-  // 34 in total
-  // +10 buffer
-  DynamicJsonDocument response(34 + data_size + 10);
+  // {"jsonrpc":"2.0","id":,"result":}
+  // a slot per member, the literals are linked, data_size holds the result
+  DynamicJsonDocument response(JSON_OBJECT_SIZE(3) + data_size + _CREDIT_SIZE);
   response["jsonrpc"] = "2.0";
   response["id"] = id;
   return response;
 }
 
 void SerialJsonRpcBoard::_send_response(DynamicJsonDocument &response) {
-  serializeJson(response, Serial);
+  // the deepest point of every handler, all response documents are allocated
+  _track_document(response);
+  _track_stack();
+
+#if SERIAL_JSON_RPC_CREDIT
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  // sampled calls go out as notifications, without credit
+  if (!sampling_subscription)
+#endif
+  _add_credit(response);
+#endif
+
+#if SERIAL_JSON_RPC_TRACE
+  // only the first response of a request is traced
+  bool traced = trace_active && !(current_trace.reached & _TRACE_HANDLED);
+  if (traced) {
+    current_trace.handled_us = micros();
+    current_trace.reached |= _TRACE_HANDLED;
+  }
+#endif
+
+  size_t written = _serialize_response(response);
   response.clear();
   response.garbageCollect();
 
-  Serial.write(_END_OF_JSON_RPC_MESSAGE);
+  written += Serial.write(_END_OF_JSON_RPC_MESSAGE);
+#if SERIAL_JSON_RPC_TRACE
+  if (traced) {
+    current_trace.serialized_us = micros();
+    current_trace.reached |= _TRACE_SERIALIZED;
+  }
+#endif
   Serial.flush();
+#if SERIAL_JSON_RPC_TRACE
+  if (traced) {
+    current_trace.sent_us = micros();
+    current_trace.reached |= _TRACE_SENT;
+  }
+#endif
+
+#if SERIAL_JSON_RPC_STATS
+  if (current_method_stats) {
+    current_method_stats->bytes_out += written;
+  }
+#else
+  (void)written;
+#endif
+}
+
+size_t SerialJsonRpcBoard::_serialize_response(DynamicJsonDocument &response) {
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  // responses of the sampled calls go out as notifications
+  if (sampling_subscription) {
+    return _serialize_notification(response);
+  }
+#endif
+  return serializeJson(response, Serial);
+}
+
+void SerialJsonRpcBoard::_run_subscriptions() {
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+  for (int i = 0; i < SERIAL_JSON_RPC_SUBSCRIPTIONS; i++) {
+    Subscription& subscription = subscriptions[i];
+    unsigned long now_ms = millis();
+    if (!subscription.id || (long)(now_ms - subscription.next_ms) < 0) {
+      continue;
+    }
+
+    // the rate follows the board clock, late samples don't pile up
+    subscription.next_ms += subscription.period_ms;
+    if ((long)(now_ms - subscription.next_ms) >= 0) {
+      subscription.next_ms = now_ms + subscription.period_ms;
+    }
+
+    _sample_subscription(subscription);
+
+    // keep the HW RX buffer drained between samples
+    _receive();
+  }
+#endif
+}
+
+#if SERIAL_JSON_RPC_CREDIT
+void SerialJsonRpcBoard::_add_credit(DynamicJsonDocument &response) {
+  int free_slots = _JSON_RPC_QUEUE_SIZE - request_queue_count;
+  int free_bytes = _JSON_RPC_BUFFER_SIZE - serial_read_buffer_pos;
+  if (processing_request) {
+    // the answered request is still at the buffer start
+    free_slots++;
+    free_bytes += request_queue_lengths[0];
+  }
+
+  JsonArray credit = response.createNestedArray("credit");
+  credit.add(free_slots);
+  credit.add(free_bytes);
+}
+#endif
+
+#if SERIAL_JSON_RPC_RX_RING
+SerialJsonRpcBoard* SerialJsonRpcBoard::rx_ring_board = 0;
+
+void SerialJsonRpcBoard::_rx_ring_start() {
+  if (rx_ring_board == this) {
+    return;
+  }
+  rx_ring_board = this;
+#if defined(__AVR__)
+  // Timer0 runs millis() with the overflow interrupt, the compare A one is free,
+  // it fires once per timer cycle, every 1.024 ms at 16 MHz, whatever OCR0A is
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+#endif
+}
+
+void SerialJsonRpcBoard::rx_ring_isr() {
+  if (rx_ring_board) {
+    rx_ring_board->_rx_ring_fill();
+  }
+}
+
+void SerialJsonRpcBoard::_rx_ring_fill() {
+  int available = Serial.available();
+#ifdef SERIAL_RX_BUFFER_SIZE
+  if (available >= SERIAL_RX_BUFFER_SIZE - 1) {
+    rx_serial_overruns++;
+  }
+#endif
+
+  RxRingIndex head = rx_ring_head;
+  for (; available > 0; available--) {
+    RxRingIndex next = (head + 1) & (SERIAL_JSON_RPC_RX_RING - 1);
+    if (next == rx_ring_tail) {
+      // the rest waits in the Serial buffer
+      rx_ring_full++;
+      break;
+    }
+    rx_ring[head] = (uint8_t)Serial.read();
+    head = next;
+  }
+
+  // the bytes are written before they are published
+  __asm__ __volatile__("" ::: "memory");
+  rx_ring_head = head;
+
+  RxRingIndex used = (RxRingIndex)(head - rx_ring_tail) & (SERIAL_JSON_RPC_RX_RING - 1);
+  if (used > rx_ring_high_water) {
+    rx_ring_high_water = used;
+  }
+}
+
+SerialJsonRpcBoard::RxRingIndex SerialJsonRpcBoard::_rx_ring_head() {
+#if SERIAL_JSON_RPC_RX_RING > 256 && defined(__AVR__)
+  // a 16-bit load takes two instructions, the ISR may publish between them
+  uint8_t sreg = SREG;
+  cli();
+  RxRingIndex head = rx_ring_head;
+  SREG = sreg;
+  return head;
+#else
+  return rx_ring_head;
+#endif
+}
+
+void SerialJsonRpcBoard::_send_rx_stats(int request_id) {
+  // [ring_size, ring_high_water, ring_full, serial_overruns]
+  // the ISR counters are copied at once
+  noInterrupts();
+  long result[] = {
+    (long)SERIAL_JSON_RPC_RX_RING - 1, (long)rx_ring_high_water, (long)rx_ring_full, (long)rx_serial_overruns
+  };
+  interrupts();
+  send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+}
+#endif
+
+#if SERIAL_JSON_RPC_UPLOAD
+void SerialJsonRpcBoard::set_upload_sink(UploadSink sink, unsigned long max_size) {
+  upload_sink = sink;
+  upload_max_size = max_size;
+  upload_handle = 0;
+}
+
+long SerialJsonRpcBoard::upload_size(long handle) const {
+  if (handle == 0 || handle != upload_handle || upload_received_size != upload_expected_size) {
+    return -1;
+  }
+  return upload_received_size;
+}
+
+void SerialJsonRpcBoard::_upload_begin(int request_id, const String params[], int params_size) {
+  // [size] -> [handle]
+  if (!upload_sink) {
+    send_error(request_id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("no upload sink"));
+    return;
+  }
+  long size = params_size == 1 ? params[0].toInt() : 0;
+  if (size <= 0 || (unsigned long)size > upload_max_size) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("size over the upload sink max size"));
+    return;
+  }
+
+  // a new upload drops the open one
+  upload_last_handle = upload_last_handle < LONG_MAX ? upload_last_handle + 1 : 1;
+  upload_handle = upload_last_handle;
+  upload_expected_size = size;
+  upload_received_size = 0;
+  send_result_longs(request_id, &upload_handle, 1);
+}
+
+void SerialJsonRpcBoard::_upload_chunk(int request_id, const String params[], int params_size) {
+  // [handle, offset, bytes] -> [received_size]
+  if (params_size != 3) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("params_size != 3"));
+    return;
+  }
+  if (upload_handle == 0 || params[0].toInt() != upload_handle) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("unknown upload handle"));
+    return;
+  }
+  // chunks come in order, so the sink can write them as they arrive
+  if ((unsigned long)params[1].toInt() != upload_received_size) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("offset != received size"));
+    return;
+  }
+
+  uint8_t buffer[_UPLOAD_CHUNK_MAX_SIZE];
+  long size = json_array_to_bytes(params[2], buffer, sizeof(buffer));
+  if (size <= 0 || upload_received_size + size > upload_expected_size) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("expected 1..64 bytes within the upload size"));
+    return;
+  }
+  if (!upload_sink(upload_received_size, buffer, size)) {
+    upload_handle = 0;
+    send_error(request_id, JsonRpcErrorCode::SERVER_ERROR, F("Server error"), F("upload sink rejected the chunk"));
+    return;
+  }
+
+  upload_received_size += size;
+  long received_size = upload_received_size;
+  send_result_longs(request_id, &received_size, 1);
+}
+#endif
+
+#if SERIAL_JSON_RPC_BYTE_SINKS
+bool SerialJsonRpcBoard::set_byte_sink(const char* method, int param_index, uint8_t* buffer, size_t capacity) {
+  if (byte_sinks_count >= SERIAL_JSON_RPC_BYTE_SINKS) {
+    return false;
+  }
+  ByteSink& sink = byte_sinks[byte_sinks_count++];
+  sink.method = method;
+  sink.param_index = param_index;
+  sink.buffer = buffer;
+  sink.capacity = capacity;
+  sink.queued = 0;
+  return true;
+}
+
+long SerialJsonRpcBoard::byte_sink_size() const {
+  return current_byte_sink_size >= 0 ? current_byte_sink_size : -1;
+}
+
+void SerialJsonRpcBoard::_scan_reset() {
+  scan_depth = 0;
+  scan_in_string = scan_escape = false;
+  scan_value = false;
+  scan_key = SCAN_KEY_OTHER;
+  scan_string_length = 0;
+  scan_in_params = false;
+  scan_param_index = 0;
+  scan_sink = -1;
+  scan_streaming = scan_streamed = scan_error = false;
+  scan_number = -1;
+  scan_count = 0;
+  partial_byte_sink_size = _BYTE_SINK_INVALID;
+}
+
+bool SerialJsonRpcBoard::_scan_char(char& c) {
+  if (scan_in_string) {
+    if (!scan_escape && c == '\\') {
+      scan_escape = true;
+    } else if (!scan_escape && c == '"') {
+      scan_in_string = false;
+      if (scan_depth == 1) {
+        _scan_string_end();
+      }
+    } else {
+      scan_escape = false;
+      if (scan_depth == 1 && scan_string_length < _BYTE_SINK_METHOD_SIZE) {
+        // the last slot is kept for \0, a string reaching it is truncated
+        if (scan_string_length < _BYTE_SINK_METHOD_SIZE - 1) {
+          scan_string[scan_string_length] = c;
+        }
+        scan_string_length++;
+      }
+    }
+    // strings in the sink array make it invalid
+    return !scan_streaming;
+  }
+
+  if (scan_streaming && scan_depth == 3) {
+    if (c >= '0' && c <= '9') {
+      scan_number = (scan_number < 0 ? 0 : scan_number) * 10 + (c - '0');
+      if (scan_number > 255) {
+        // stays over 255 without overflowing
+        scan_number = 256;
+        scan_error = true;
+      }
+      return false;
+    }
+    if (c == ',' || c == ']' || c == ' ' || c == '\t' || c == '\r') {
+      _scan_flush_number();
+    } else {
+      scan_error = true;
+    }
+  }
+
+  switch (c) {
+    case '"':
+      scan_in_string = true;
+      scan_string_length = 0;
+      break;
+    case '[':
+      if (scan_depth == 1 && scan_value && scan_key == SCAN_KEY_PARAMS) {
+        scan_in_params = true;
+        scan_param_index = 0;
+      } else if (scan_depth == 2 && scan_in_params && scan_sink >= 0 && !scan_streamed &&
+                 scan_param_index == byte_sinks[scan_sink].param_index && byte_sinks[scan_sink].queued == 0) {
+        // the array goes to the sink from here
+        scan_streaming = scan_streamed = true;
+        scan_depth++;
+        return false;
+      }
+      scan_depth++;
+      break;
+    case '{':
+      scan_depth++;
+      break;
+    case ']':
+    case '}':
+      if (scan_depth > 0) {
+        scan_depth--;
+      }
+      if (scan_streaming && scan_depth == 2) {
+        // the handler gets "0" for the whole array
+        partial_byte_sink_size = scan_error ? _BYTE_SINK_INVALID : (int)scan_count;
+        scan_streaming = false;
+        c = '0';
+        return true;
+      }
+      if (scan_depth == 1) {
+        scan_in_params = false;
+      }
+      break;
+    case ':':
+      if (scan_depth == 1) {
+        scan_value = true;
+      }
+      break;
+    case ',':
+      if (scan_depth == 1) {
+        scan_value = false;
+      } else if (scan_depth == 2 && scan_in_params) {
+        scan_param_index++;
+      }
+      break;
+  }
+  return !scan_streaming;
+}
+
+void SerialJsonRpcBoard::_scan_string_end() {
+  bool truncated = scan_string_length >= _BYTE_SINK_METHOD_SIZE;
+  if (truncated) {
+    scan_string[0] = '\0';
+  } else {
+    scan_string[scan_string_length] = '\0';
+  }
+
+  if (!scan_value) {
+    scan_key = strcmp_P(scan_string, PSTR("method")) == 0 ? SCAN_KEY_METHOD :
+               strcmp_P(scan_string, PSTR("params")) == 0 ? SCAN_KEY_PARAMS : SCAN_KEY_OTHER;
+    return;
+  }
+  if (scan_key != SCAN_KEY_METHOD || truncated) {
+    return;
+  }
+  for (int i = 0; i < byte_sinks_count; i++) {
+    if (strcmp(byte_sinks[i].method, scan_string) == 0) {
+      scan_sink = i;
+      return;
+    }
+  }
+}
+
+void SerialJsonRpcBoard::_scan_flush_number() {
+  if (scan_number < 0) {
+    return;
+  }
+  ByteSink& sink = byte_sinks[scan_sink];
+  if (scan_number > 255 || scan_count >= sink.capacity) {
+    scan_error = true;
+  } else {
+    sink.buffer[scan_count++] = (uint8_t)scan_number;
+  }
+  scan_number = -1;
+}
+#endif
+
+#if SERIAL_JSON_RPC_EVENTS
+bool SerialJsonRpcBoard::push_event(uint8_t type, uint16_t value) {
+  uint8_t head = events_head;
+  uint8_t next = (head + 1) & (SERIAL_JSON_RPC_EVENTS - 1);
+  if (next == events_tail) {
+    events_dropped++;
+    return false;
+  }
+
+  Event& event = events[head];
+  event.type = type;
+  event.value = value;
+  event.time_us = micros();
+  // the slot is written before it is published
+  __asm__ __volatile__("" ::: "memory");
+  events_head = next;
+  return true;
+}
+#endif
+
+void SerialJsonRpcBoard::_send_events() {
+#if SERIAL_JSON_RPC_EVENTS
+  uint8_t dropped = events_dropped - events_dropped_reported;
+  // drain what is queued so far, a burst goes out in back to back batches,
+  // events pushed meanwhile wait for the next loop() so ISR floods can't stall it
+  uint8_t head = events_head;
+  while (events_tail != head || dropped) {
+    // {"jsonrpc":"2.0","method":"rpc.events","params":{"dropped":0,"events":[[type,value,t],...]}}
+    // streamed, no JSON document
+    Serial.print(F("{\"jsonrpc\":\"2.0\",\"method\":\"rpc.events\",\"params\":{\"dropped\":"));
+    Serial.print((int)dropped);
+    Serial.print(F(",\"events\":["));
+    events_dropped_reported += dropped;
+    dropped = 0;
+
+    for (int i = 0; i < _EVENTS_BATCH_SIZE && events_tail != head; i++) {
+      // the slot is read after it is published
+      __asm__ __volatile__("" ::: "memory");
+      const Event& event = events[events_tail];
+      if (i) {
+        Serial.print(F(","));
+      }
+      Serial.print(F("["));
+      Serial.print((int)event.type);
+      Serial.print(F(","));
+      Serial.print((unsigned long)event.value);
+      Serial.print(F(","));
+      Serial.print(event.time_us);
+      Serial.print(F("]"));
+      // the slot is released after it is read
+      __asm__ __volatile__("" ::: "memory");
+      events_tail = (events_tail + 1) & (SERIAL_JSON_RPC_EVENTS - 1);
+    }
+
+    Serial.print(F("]}}"));
+    Serial.write(_END_OF_JSON_RPC_MESSAGE);
+    Serial.flush();
+  }
+#endif
+}
+
+#if SERIAL_JSON_RPC_SUBSCRIPTIONS
+void SerialJsonRpcBoard::_subscribe(int request_id, const String params[], int params_size) {
+  // rpc.subscribe(method, params, period_ms) -> [subscription]
+  if (params_size != 3 || params[1][0] != '[' || params[2].toInt() < 1) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("expected method, params array, period_ms"));
+    return;
+  }
+  if (is_method(params[0], F("rpc.subscribe")) || is_method(params[0], F("rpc.unsubscribe"))) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("method can't be subscribed"));
+    return;
+  }
+  if (params[0].length() + 1 + params[1].length() + 1 > _SUBSCRIPTION_REQUEST_SIZE) {
+    send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("method and params too long"));
+    return;
+  }
+
+  for (int i = 0; i < SERIAL_JSON_RPC_SUBSCRIPTIONS; i++) {
+    Subscription& subscription = subscriptions[i];
+    if (subscription.id) {
+      continue;
+    }
+
+    // ids stay positive
+    subscription_last_id = subscription_last_id < INT_MAX ? subscription_last_id + 1 : 1;
+    subscription.id = subscription_last_id;
+    subscription.period_ms = params[2].toInt();
+    // the first sample follows the response
+    subscription.next_ms = millis();
+    strcpy(subscription.request, params[0].c_str());
+    strcpy(subscription.request + params[0].length() + 1, params[1].c_str());
+
+    long result = subscription.id;
+    send_result_longs(request_id, &result, 1);
+    return;
+  }
+  send_error(request_id, JsonRpcErrorCode::INTERNAL_ERROR, F("Internal error"), F("too many subscriptions"));
+}
+
+void SerialJsonRpcBoard::_unsubscribe(int request_id, const String params[], int params_size) {
+  // rpc.unsubscribe(subscription) -> [subscription]
+  long subscription_id = params_size == 1 ? params[0].toInt() : 0;
+  for (int i = 0; subscription_id > 0 && i < SERIAL_JSON_RPC_SUBSCRIPTIONS; i++) {
+    if (subscriptions[i].id == subscription_id) {
+      subscriptions[i].id = 0;
+      send_result_longs(request_id, &subscription_id, 1);
+      return;
+    }
+  }
+  send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("unknown subscription"));
+}
+
+void SerialJsonRpcBoard::_sample_subscription(Subscription& subscription) {
+  const char* method = subscription.request;
+  // zero-copy parsing modifies the input
+  char params_buffer[_SUBSCRIPTION_REQUEST_SIZE];
+  strcpy(params_buffer, method + strlen(method) + 1);
+
+  DynamicJsonDocument params(JSON_ARRAY_SIZE(strlen(params_buffer) / 2 + 1));
+  deserializeJson(params, params_buffer);
+  _track_document(params);
+
+#if SERIAL_JSON_RPC_STATS
+  current_request_bytes = 0;
+#endif
+  subscription_sample_us = micros();
+#if SERIAL_JSON_RPC_RX_TIMESTAMPS
+  // the sample time stands for the request RX, e.g. for rpc.time
+  current_request_rx_us = subscription_sample_us;
+#endif
+  // the request id is never sent, any response of the call becomes the sample
+  sampling_subscription = subscription.id;
+  _call_method(subscription.id, String(method), params.as<JsonArray>());
+  sampling_subscription = 0;
+}
+
+size_t SerialJsonRpcBoard::_serialize_notification(DynamicJsonDocument &response) {
+  // {"jsonrpc":"2.0","method":"rpc.subscription","params":{"subscription":1,"t":0,"result":...}}
+  // streamed around the response result, no second document
+  size_t written = Serial.print(F("{\"jsonrpc\":\"2.0\",\"method\":\"rpc.subscription\",\"params\":{\"subscription\":"));
+  written += Serial.print(sampling_subscription);
+  written += Serial.print(F(",\"t\":"));
+  written += Serial.print(subscription_sample_us);
+  if (response.containsKey("error")) {
+    written += Serial.print(F(",\"error\":"));
+    written += serializeJson(response["error"], Serial);
+  } else {
+    written += Serial.print(F(",\"result\":"));
+    written += serializeJson(response["result"], Serial);
+  }
+  written += Serial.print(F("}}"));
+  return written;
+}
+#endif
+
+#if SERIAL_JSON_RPC_STATS
+uint32_t SerialJsonRpcBoard::_method_hash(const char* method) {
+  // FNV-1a, 32 bit
+  uint32_t hash = 2166136261UL;
+  while (*method) {
+    hash ^= (uint8_t)*method++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+void SerialJsonRpcBoard::_stats_begin_call(const String& method) {
+  uint32_t method_hash = _method_hash(method.c_str());
+
+  current_method_stats = 0;
+  for (int i = 0; i < method_stats_count; i++) {
+    if (method_stats[i].method_hash == method_hash) {
+      current_method_stats = &method_stats[i];
+      break;
+    }
+  }
+  if (!current_method_stats) {
+    if (method_stats_count == SERIAL_JSON_RPC_STATS_METHODS) {
+      stats_untracked_calls++;
+      return;
+    }
+    current_method_stats = &method_stats[method_stats_count++];
+    current_method_stats->method_hash = method_hash;
+  }
+
+  current_method_stats->calls++;
+  current_method_stats->bytes_in += current_request_bytes;
+}
+
+void SerialJsonRpcBoard::_stats_end_call(unsigned long start_us) {
+  // the table may have been reset by rpc.stats
+  if (current_method_stats && current_method_stats->method_hash) {
+    unsigned long elapsed_us = micros() - start_us;
+    current_method_stats->total_us += elapsed_us;
+    if (elapsed_us > current_method_stats->max_us) {
+      current_method_stats->max_us = elapsed_us;
+    }
+  }
+  current_method_stats = 0;
+}
+
+void SerialJsonRpcBoard::_send_stats(int request_id, const String params[], int params_size) {
+  // one method per call keeps the response within UNO R3 heap
+  // rpc.stats() -> [requests, parse_errors, overflows, invalid_requests, untracked_calls, methods]
+  // rpc.stats(i) -> [method_hash, calls, errors, total_us, max_us, bytes_in, bytes_out]
+  // rpc.stats("reset") -> rpc.stats() before all counters are cleared
+  if (params_size == 1 && strcmp_P(params[0].c_str(), PSTR("reset")) != 0) {
+    long index = params[0].toInt();
+    if (index < 0 || index >= method_stats_count) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("method index out of range"));
+      return;
+    }
+    const MethodStats& stats = method_stats[index];
+    long result[] = {
+      (long)stats.method_hash, (long)stats.calls, (long)stats.errors,
+      (long)stats.total_us, (long)stats.max_us, (long)stats.bytes_in, (long)stats.bytes_out
+    };
+    send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+    return;
+  }
+
+  long result[] = {
+    (long)stats_requests, (long)stats_parse_errors, (long)stats_overflows,
+    (long)stats_invalid_requests, (long)stats_untracked_calls, (long)method_stats_count
+  };
+  send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+
+  if (params_size == 1) {
+    memset(method_stats, 0, sizeof(method_stats));
+    method_stats_count = 0;
+    stats_requests = stats_parse_errors = stats_overflows = stats_invalid_requests = stats_untracked_calls = 0;
+  }
+}
+#endif
+
+#if SERIAL_JSON_RPC_TRACE
+const SerialJsonRpcBoard::TraceRecord& SerialJsonRpcBoard::_trace_record(int index) {
+  // 0 is the oldest kept record
+  unsigned long first = trace_count > SERIAL_JSON_RPC_TRACE_SIZE ? trace_count - SERIAL_JSON_RPC_TRACE_SIZE : 0;
+  return trace_records[(first + index) % SERIAL_JSON_RPC_TRACE_SIZE];
+}
+
+void SerialJsonRpcBoard::_send_trace(int request_id, const String params[], int params_size) {
+  // rpc.trace() -> [records, traced_requests]
+  // rpc.trace(i) -> [id, first_byte_us, terminator_us, parsed_us, handled_us, serialized_us, sent_us, reached]
+  //   reached has bit 0 for parsed_us to bit 3 for sent_us set once the request got there
+  // rpc.trace("bin", i) -> up to 3 records from i, 18 bytes each:
+  //   int32 id, uint32 first_byte_us, uint16 deltas to the other 5 stages, all little endian,
+  //   0xFFFF when not reached or above 65535 us
+  // rpc.trace("reset") -> rpc.trace() before the ring is cleared
+  int records = trace_count < SERIAL_JSON_RPC_TRACE_SIZE ? trace_count : SERIAL_JSON_RPC_TRACE_SIZE;
+
+  if (params_size == 2 && strcmp_P(params[0].c_str(), PSTR("bin")) == 0) {
+    long index = params[1].toInt();
+    if (index < 0 || index > records) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("record index out of range"));
+      return;
+    }
+    uint8_t buffer[_TRACE_BINARY_RECORDS * _TRACE_BINARY_RECORD_SIZE];
+    size_t size = 0;
+    for (long i = index; i < records && i < index + _TRACE_BINARY_RECORDS; i++) {
+      const TraceRecord& record = _trace_record(i);
+      unsigned long stages[] = {
+        record.terminator_us, record.parsed_us, record.handled_us, record.serialized_us, record.sent_us
+      };
+      // the terminator is always read before the request is processed
+      uint8_t reached = 1 | (record.reached << 1);
+      for (int b = 0; b < 4; b++) {
+        buffer[size++] = (uint8_t)((unsigned long)record.id >> (8 * b));
+      }
+      for (int b = 0; b < 4; b++) {
+        buffer[size++] = (uint8_t)(record.first_byte_us >> (8 * b));
+      }
+      for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+        unsigned long delta = stages[s] - record.first_byte_us;
+        if (!(reached & (1 << s)) || delta > 0xFFFF) {
+          delta = 0xFFFF;
+        }
+        buffer[size++] = (uint8_t)delta;
+        buffer[size++] = (uint8_t)(delta >> 8);
+      }
+    }
+    send_result_bytes(request_id, buffer, size);
+    return;
+  }
+
+  if (params_size == 1 && strcmp_P(params[0].c_str(), PSTR("reset")) != 0) {
+    long index = params[0].toInt();
+    if (index < 0 || index >= records) {
+      send_error(request_id, JsonRpcErrorCode::INVALID_PARAMS, F("Invalid params"), F("record index out of range"));
+      return;
+    }
+    const TraceRecord& record = _trace_record(index);
+    long result[] = {
+      record.id, (long)record.first_byte_us, (long)record.terminator_us, (long)record.parsed_us,
+      (long)record.handled_us, (long)record.serialized_us, (long)record.sent_us, (long)record.reached
+    };
+    send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+    return;
+  }
+
+  long result[] = {(long)records, (long)trace_count};
+  send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+
+  if (params_size == 1) {
+    memset(trace_records, 0, sizeof(trace_records));
+    trace_count = 0;
+  }
+}
+#endif
+
+void SerialJsonRpcBoard::_track_document(const JsonDocument& document) {
+#if SERIAL_JSON_RPC_MEMORY_STATS
+  // DynamicJsonDocument gets 0 capacity when malloc() fails
+  if (document.capacity() == 0) {
+    allocation_failures++;
+  }
+  if (document.overflowed()) {
+    document_overflows++;
+  }
+  if (document.capacity() > document_capacity_high_water) {
+    document_capacity_high_water = document.capacity();
+  }
+  if (document.memoryUsage() > document_usage_high_water) {
+    document_usage_high_water = document.memoryUsage();
+  }
+#else
+  (void)document;
+#endif
+}
+
+void SerialJsonRpcBoard::_track_stack() {
+#if SERIAL_JSON_RPC_MEMORY_STATS
+  long free_ram = _free_ram();
+  if (free_ram >= 0 && (free_ram_low_water < 0 || free_ram < free_ram_low_water)) {
+    free_ram_low_water = free_ram;
+  }
+#if defined(__AVR__)
+  long stack = RAMEND - SP;
+  if (stack > stack_high_water) {
+    stack_high_water = stack;
+  }
+#endif
+#endif
+}
+
+#if SERIAL_JSON_RPC_MEMORY_STATS
+long SerialJsonRpcBoard::_free_ram() {
+#if defined(__AVR__)
+  // gap between the heap top and the stack
+  char top;
+  return &top - (__brkval ? __brkval : &__heap_start);
+#else
+  return -1;
+#endif
+}
+
+void SerialJsonRpcBoard::_send_memory(int request_id) {
+  // [buffer_size, rx_buffer_high_water, queue_high_water,
+  //  document_capacity_high_water, document_usage_high_water, allocation_failures, document_overflows,
+  //  free_ram, free_ram_low_water, stack_high_water]
+  long result[] = {
+    (long)_JSON_RPC_BUFFER_SIZE, (long)rx_buffer_high_water, (long)request_queue_high_water,
+    (long)document_capacity_high_water, (long)document_usage_high_water,
+    (long)allocation_failures, (long)document_overflows,
+    _free_ram(), free_ram_low_water, stack_high_water
+  };
+  send_result_longs(request_id, result, sizeof(result) / sizeof(result[0]));
+}
+#endif
+
 }
 
+#if SERIAL_JSON_RPC_RX_RING && defined(__AVR__)
+ISR(TIMER0_COMPA_vect) {
+  SerialJsonRpcLibrary::SerialJsonRpcBoard::rx_ring_isr();
 }
+#endif
 
 #endif  // !__serial_json_rpc_lib_h__
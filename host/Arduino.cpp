@@ -0,0 +1,55 @@
+// Time and pin functions of the host Arduino shim,
+// Serial is implemented by the target (virtual_board.cpp, bench/board_bench.cpp)
+
+#include <Arduino.h>
+
+#include <time.h>
+#include <unistd.h>
+
+
+static struct timespec get_start_ts() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts;
+}
+
+static const struct timespec start_ts = get_start_ts();
+static uint8_t pin_values[256];
+
+
+static uint64_t elapsed_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)(ts.tv_sec - start_ts.tv_sec) * 1000000 + (ts.tv_nsec - start_ts.tv_nsec) / 1000;
+}
+
+// unsigned long is 64-bit here, so there is no wraparound like on the boards:
+// truncating to 32 bits would only break the callers' unsigned long differences
+unsigned long millis() {
+  return elapsed_us() / 1000;
+}
+
+unsigned long micros() {
+  return elapsed_us();
+}
+
+void delay(unsigned long ms) {
+  usleep(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  usleep(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  pin_values[pin] = value;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin_values[pin];
+}
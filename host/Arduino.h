@@ -0,0 +1,184 @@
+#ifndef __serial_json_rpc_host_arduino_h__
+#define __serial_json_rpc_host_arduino_h__
+
+// Minimal Arduino core for building the board code on Linux.
+// Covers what board.ino, serial_json_rpc.h and ArduinoJson use,
+// Serial is implemented per target: a pseudo-terminal in virtual_board.cpp,
+// memory buffers in bench/board_bench.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <string>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define LED_BUILTIN 13
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// there is one address space on the host, flash strings are plain strings
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_float(addr) (*(const float*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcmp_P memcmp
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(PSTR(s)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+// there are no interrupts on the host, ISR code runs from the main thread
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+inline int digitalPinToInterrupt(uint8_t pin) { return pin == 2 ? 0 : pin == 3 ? 1 : -1; }
+inline void attachInterrupt(int interrupt, void (*isr)(), int mode) { (void)interrupt; (void)isr; (void)mode; }
+
+
+class String {
+public:
+  String(const char* str = "") : value(str ? str : "") {}
+  String(const std::string& str) : value(str) {}
+  String(const __FlashStringHelper* str) : value((PGM_P)str) {}
+  explicit String(char c) : value(1, c) {}
+  explicit String(int n) : value(std::to_string(n)) {}
+  explicit String(unsigned int n) : value(std::to_string(n)) {}
+  explicit String(long n) : value(std::to_string(n)) {}
+  explicit String(unsigned long n) : value(std::to_string(n)) {}
+
+  const char* c_str() const { return value.c_str(); }
+  unsigned int length() const { return value.length(); }
+  bool reserve(unsigned int size) { value.reserve(size); return true; }
+
+  bool concat(const char* str) { value += str; return true; }
+  bool concat(const char* str, unsigned int size) { value.append(str, size); return true; }
+  bool concat(char c) { value += c; return true; }
+  String& operator+=(const char* str) { value += str; return *this; }
+  String& operator+=(const String& str) { value += str.value; return *this; }
+  String& operator+=(char c) { value += c; return *this; }
+
+  char operator[](unsigned int index) const { return value[index]; }
+  bool operator==(const String& other) const { return value == other.value; }
+  bool operator==(const char* other) const { return value == other; }
+  bool operator!=(const String& other) const { return value != other.value; }
+  bool operator!=(const char* other) const { return value != other; }
+
+  bool equals(const char* other) const { return value == other; }
+  bool startsWith(const char* prefix) const { return value.compare(0, strlen(prefix), prefix) == 0; }
+  long toInt() const { return atol(value.c_str()); }
+
+private:
+  std::string value;
+};
+
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size-- && write(*buffer++)) {
+      n++;
+    }
+    return n;
+  }
+  size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+  size_t print(const char* str) { return write(str); }
+  size_t print(const String& str) { return write(str.c_str()); }
+  size_t print(const __FlashStringHelper* str) { return write((PGM_P)str); }
+  size_t print(long n) { return print(String(n)); }
+  size_t print(unsigned long n) { return print(String(n)); }
+  size_t print(int n) { return print(String(n)); }
+  size_t println(const char* str) { return print(str) + write('\n'); }
+
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+};
+
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  size_t readBytes(char* buffer, size_t length) {
+    size_t n = 0;
+    while (n < length) {
+      int c = read();
+      if (c < 0) {
+        break;
+      }
+      buffer[n++] = (char)c;
+    }
+    return n;
+  }
+};
+
+
+class HardwareSerial : public Stream {
+public:
+  HardwareSerial() : fd(-1), peeked(-1) {}
+
+  void begin(unsigned long baudrate) { (void)baudrate; }
+  void end() {}
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite() override { return 64; }
+  void flush() override;
+
+  operator bool() const { return fd >= 0; }
+
+  // host only: pseudo-terminal master side
+  void attach(int master_fd) { fd = master_fd; }
+  // host only: sleep until RX data arrives or timeout_us passes
+  void wait(unsigned long timeout_us);
+
+private:
+  int fd;
+  int peeked;
+};
+
+extern HardwareSerial Serial;
+
+#endif  // !__serial_json_rpc_host_arduino_h__
@@ -0,0 +1,375 @@
+// Host micro-benchmarks of the SerialJsonRpcBoard hot paths, see README.md "Benchmarks".
+// Serial is backed by memory buffers, every stage runs for message sizes up to _JSON_RPC_BUFFER_SIZE
+// and reports ns/op, heap allocations per op and peak heap bytes per op.
+//
+//   ./board_bench            # table
+//   ./board_bench --json     # for compare.py
+//   ./board_bench receive    # only benchmarks with the prefix
+
+#include <Arduino.h>
+
+#include <limits.h>
+#include <malloc.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// stage functions are private members of SerialJsonRpcBoard, it befriends BoardBench for this build
+#define SERIAL_JSON_RPC_BENCH 1
+#include "serial_json_rpc.h"
+
+using namespace SerialJsonRpcLibrary;
+
+
+namespace SerialJsonRpcLibrary {
+struct BoardBench {
+  static void reset(SerialJsonRpcBoard& board) {
+    board.serial_read_buffer_pos = 0;
+    board.request_queue_count = 0;
+    board.request_queue_bytes = 0;
+  }
+
+  static void receive(SerialJsonRpcBoard& board) {
+    board._receive();
+  }
+
+  static void process_request(SerialJsonRpcBoard& board, JsonDocument& request) {
+    board._process_request(request);
+  }
+
+  static size_t request_capacity(const char* json, int length) {
+    return SerialJsonRpcBoard::_request_capacity(json, length);
+  }
+};
+}
+
+
+// memory Serial
+
+static std::string rx_data;
+static size_t rx_pos = 0;
+static size_t tx_bytes = 0;
+
+HardwareSerial Serial;
+
+int HardwareSerial::available() {
+  return rx_data.size() - rx_pos;
+}
+
+int HardwareSerial::read() {
+  return rx_pos < rx_data.size() ? (uint8_t)rx_data[rx_pos++] : -1;
+}
+
+int HardwareSerial::peek() {
+  return rx_pos < rx_data.size() ? (uint8_t)rx_data[rx_pos] : -1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  (void)buffer;
+  tx_bytes += size;
+  return size;
+}
+
+void HardwareSerial::flush() {}
+
+void HardwareSerial::wait(unsigned long timeout_us) {
+  (void)timeout_us;
+}
+
+
+// heap accounting, glibc only
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static bool heap_tracking = false;
+static size_t heap_allocs = 0;
+static size_t heap_bytes = 0;
+static size_t heap_peak_bytes = 0;
+
+static void heap_track_alloc(void* ptr) {
+  if (!heap_tracking || !ptr) {
+    return;
+  }
+  heap_allocs++;
+  heap_bytes += malloc_usable_size(ptr);
+  if (heap_bytes > heap_peak_bytes) {
+    heap_peak_bytes = heap_bytes;
+  }
+}
+
+static void heap_track_free(void* ptr) {
+  if (!heap_tracking || !ptr) {
+    return;
+  }
+  size_t size = malloc_usable_size(ptr);
+  heap_bytes = heap_bytes > size ? heap_bytes - size : 0;
+}
+
+extern "C" void* malloc(size_t size) {
+  void* ptr = __libc_malloc(size);
+  heap_track_alloc(ptr);
+  return ptr;
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+  void* ptr = __libc_calloc(count, size);
+  heap_track_alloc(ptr);
+  return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+  heap_track_free(ptr);
+  void* new_ptr = __libc_realloc(ptr, size);
+  heap_track_alloc(new_ptr);
+  return new_ptr;
+}
+
+extern "C" void free(void* ptr) {
+  heap_track_free(ptr);
+  __libc_free(ptr);
+}
+
+
+// harness
+
+struct BenchResult {
+  std::string name;
+  size_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  size_t peak_bytes;
+};
+
+typedef void (*BenchSetup)(int size);
+typedef void (*BenchOp)(int size);
+
+static const double BENCH_MIN_SEC = 0.2;
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// setup runs before every op and is not timed
+static BenchResult run_bench(const std::string& name, int size, BenchSetup setup, BenchOp op) {
+  // peak and allocation count of a single op
+  setup(size);
+  heap_allocs = 0;
+  heap_bytes = 0;
+  heap_peak_bytes = 0;
+  heap_tracking = true;
+  op(size);
+  heap_tracking = false;
+
+  BenchResult result = { name, 0, 0, (double)heap_allocs, heap_peak_bytes };
+
+  double total_ns = 0;
+  size_t batch = 1;
+  while (total_ns < BENCH_MIN_SEC * 1e9) {
+    for (size_t i = 0; i < batch; i++) {
+      setup(size);
+      double start_ns = now_ns();
+      op(size);
+      total_ns += now_ns() - start_ns;
+    }
+    result.iterations += batch;
+    batch *= 2;
+  }
+  result.ns_per_op = total_ns / result.iterations;
+  return result;
+}
+
+
+// stages
+
+static void rpc_processor_noop(int request_id, const String& method, const String params[], int params_size) {
+  (void)request_id;
+  (void)method;
+  (void)params;
+  (void)params_size;
+}
+
+static SerialJsonRpcBoard rpc_board(rpc_processor_noop);
+
+static std::string request_frame;
+static std::string rx_frame;
+static char parse_buffer[SERIAL_JSON_RPC_BUFFER_SIZE];
+// parsed_request strings point into it
+static char parsed_request_buffer[SERIAL_JSON_RPC_BUFFER_SIZE];
+// a slot per byte is more than any request takes
+static DynamicJsonDocument parsed_request(JSON_ARRAY_SIZE(SERIAL_JSON_RPC_BUFFER_SIZE));
+static uint8_t result_bytes[256];
+static long result_longs[256];
+static std::string result_string;
+
+// {"jsonrpc":"2.0","id":1,"method":"write_page","params":[0,[...]]} of exactly `size` bytes
+static std::string build_request(int size) {
+  std::string head = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"write_page\",\"params\":[0,[";
+  std::string tail = "]]}";
+  std::string data;
+  for (;;) {
+    int left = size - (int)(head.size() + data.size() + tail.size());
+    if (left <= 0) {
+      break;
+    }
+    if (data.empty()) {
+      data = "1";
+    } else if (left == 1) {
+      // JSON whitespace pads the last byte
+      data += " ";
+    } else {
+      data += left >= 4 ? ",255" : left == 3 ? ",10" : ",1";
+    }
+  }
+  return head + data + tail;
+}
+
+static void reset_board() {
+  BoardBench::reset(rpc_board);
+}
+
+static void setup_rx(int size) {
+  (void)size;
+  reset_board();
+  rx_data = rx_frame;
+  rx_pos = 0;
+}
+
+static void setup_parse(int size) {
+  (void)size;
+  // zero-copy parsing modifies the input
+  memcpy(parse_buffer, request_frame.data(), request_frame.size());
+}
+
+static void setup_none(int size) {
+  (void)size;
+}
+
+static void op_receive(int size) {
+  (void)size;
+  BoardBench::receive(rpc_board);
+}
+
+static void op_parse(int size) {
+  (void)size;
+  DynamicJsonDocument request(BoardBench::request_capacity(parse_buffer, request_frame.size()));
+  deserializeJson(request, parse_buffer, request_frame.size());
+}
+
+static void op_process_request(int size) {
+  (void)size;
+  BoardBench::process_request(rpc_board, parsed_request);
+}
+
+static void op_loop(int size) {
+  (void)size;
+  rpc_board.loop();
+}
+
+static void op_send_result_string(int size) {
+  rpc_board.send_result_string(1, result_string.c_str() + result_string.size() - size);
+}
+
+static void op_send_result_bytes(int size) {
+  rpc_board.send_result_bytes(1, result_bytes, size);
+}
+
+static void op_send_result_longs(int size) {
+  rpc_board.send_result_longs(1, result_longs, size);
+}
+
+static void op_send_error(int size) {
+  (void)size;
+  rpc_board.send_error(1, JsonRpcErrorCode::INVALID_PARAMS, "Invalid params", "params_size != 1");
+}
+
+
+// a request that fails to parse would time the error path, the noop handler sends nothing
+static void check_request(int size) {
+  setup_parse(size);
+  DynamicJsonDocument request(BoardBench::request_capacity(parse_buffer, request_frame.size()));
+  DeserializationError error = deserializeJson(request, parse_buffer, request_frame.size());
+  setup_rx(size);
+  tx_bytes = 0;
+  op_loop(size);
+  if ((int)request_frame.size() != size || error || request["params"][1].size() == 0 || tx_bytes != 0) {
+    fprintf(stderr, "request/%d: %s, %zu response bytes\n", size, error.c_str(), tx_bytes);
+    exit(1);
+  }
+}
+
+
+int main(int argc, char** argv) {
+  bool json = false;
+  std::string filter;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  for (int i = 0; i < 256; i++) {
+    result_bytes[i] = (uint8_t)(255 - i);
+    result_longs[i] = LONG_MIN + i;
+  }
+  result_string = std::string(SERIAL_JSON_RPC_BUFFER_SIZE, 'x');
+
+  const int request_sizes[] = { 64, 128, 256, SERIAL_JSON_RPC_BUFFER_SIZE };
+  const int result_sizes[] = { 1, 16, 64, 128 };
+
+  std::vector<BenchResult> results;
+  char name[64];
+
+  for (int size : request_sizes) {
+    request_frame = build_request(size);
+    rx_frame = request_frame + "\n";
+    check_request(size);
+    memcpy(parsed_request_buffer, request_frame.data(), request_frame.size());
+    deserializeJson(parsed_request, parsed_request_buffer, request_frame.size());
+
+    snprintf(name, sizeof(name), "receive/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_rx, op_receive));
+    snprintf(name, sizeof(name), "loop/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_rx, op_loop));
+
+    snprintf(name, sizeof(name), "parse/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_parse, op_parse));
+    snprintf(name, sizeof(name), "process_request/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_none, op_process_request));
+  }
+
+  for (int size : result_sizes) {
+    snprintf(name, sizeof(name), "send_result_string/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_none, op_send_result_string));
+    snprintf(name, sizeof(name), "send_result_bytes/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_none, op_send_result_bytes));
+    snprintf(name, sizeof(name), "send_result_longs/%d", size);
+    if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, size, setup_none, op_send_result_longs));
+  }
+
+  snprintf(name, sizeof(name), "send_error");
+  if (std::string(name).find(filter) == 0) results.push_back(run_bench(name, 0, setup_none, op_send_error));
+
+  if (json) {
+    printf("[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+      const BenchResult& r = results[i];
+      printf("  {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.1f, \"peak_bytes\": %zu}%s\n",
+             r.name.c_str(), r.iterations, r.ns_per_op, r.allocs_per_op, r.peak_bytes, i + 1 < results.size() ? "," : "");
+    }
+    printf("]\n");
+  } else {
+    printf("%-28s %12s %12s %10s %10s\n", "benchmark", "iterations", "ns/op", "allocs/op", "peak B");
+    for (const BenchResult& r : results) {
+      printf("%-28s %12zu %12.1f %10.1f %10zu\n", r.name.c_str(), r.iterations, r.ns_per_op, r.allocs_per_op, r.peak_bytes);
+    }
+  }
+  return 0;
+}
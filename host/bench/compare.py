@@ -0,0 +1,52 @@
+"""
+Compares board_bench results with a baseline recorded on the same machine.
+
+    ./board_bench --json > current.json
+    python3 compare.py baseline.json current.json --threshold 0.1
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path: str) -> dict:
+    with open(path) as f:
+        return {r["name"]: r for r in json.load(f)}
+
+
+def compare() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('baseline', type=str)
+    parser.add_argument('current', type=str)
+    parser.add_argument('--threshold', type=float, default=0.1,
+                        help="allowed ns/op slowdown, 0.1 == 10%%")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressions = 0
+    print(f"{'benchmark':28} {'base ns/op':>12} {'ns/op':>12} {'delta':>8} {'allocs':>10} {'peak B':>12}")
+    for name, cur in current.items():
+        base = baseline.get(name)
+        if base is None:
+            print(f"{name:28} {'-':>12} {cur['ns_per_op']:12.1f} {'new':>8}")
+            continue
+
+        delta = cur["ns_per_op"] / base["ns_per_op"] - 1.0 if base["ns_per_op"] else 0.0
+        regressed = delta > args.threshold \
+            or cur["allocs_per_op"] > base["allocs_per_op"] \
+            or cur["peak_bytes"] > base["peak_bytes"]
+        regressions += regressed
+
+        allocs = f"{base['allocs_per_op']:g}->{cur['allocs_per_op']:g}"
+        peak = f"{base['peak_bytes']}->{cur['peak_bytes']}"
+        print(f"{name:28} {base['ns_per_op']:12.1f} {cur['ns_per_op']:12.1f} {delta:+8.1%} {allocs:>10} {peak:>12}"
+              + ("  REGRESSION" if regressed else ""))
+
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(compare())
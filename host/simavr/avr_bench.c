@@ -0,0 +1,358 @@
+// Runs the board firmware in simavr and feeds it a scripted request mix over UART0 at line rate,
+// see README.md "AVR Benchmarks". Reports per request kind:
+//   - cycles from the first request byte to the response terminator,
+//   - turnaround cycles from the request terminator to the first response byte,
+// and for the whole run the peak stack and heap and the RX bytes of requests the board did not get intact.
+//
+//   ./avr_bench -m atmega328p --heap-start 0x... --brkval 0x... firmware.elf request_mix.jsonl
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_uart.h>
+
+#define MAX_REQUESTS 64
+#define MAX_REQUEST_SIZE 1024
+#define MAX_RESPONSE_SIZE 4096
+#define MAX_IN_FLIGHT 16
+
+typedef struct {
+  char text[MAX_REQUEST_SIZE];
+  size_t size;
+  long id;
+  // stats
+  uint64_t count;
+  uint64_t errors;
+  uint64_t lost;
+  uint64_t total_cycles;
+  uint64_t max_cycles;
+  uint64_t total_turnaround_cycles;
+  uint64_t max_turnaround_cycles;
+} request_t;
+
+typedef struct {
+  int request;
+  uint64_t first_byte_cycle;
+  uint64_t last_byte_cycle;
+} in_flight_t;
+
+static request_t requests[MAX_REQUESTS];
+static int request_count = 0;
+
+// requests are answered in order
+static in_flight_t in_flight[MAX_IN_FLIGHT];
+static int in_flight_count = 0;
+
+static char response[MAX_RESPONSE_SIZE];
+static size_t response_size = 0;
+// first byte of the frame being received, a notification or a response
+static uint64_t response_first_cycle = 0;
+
+static uint64_t dropped_rx_bytes = 0;
+static uint64_t responses = 0;
+
+
+static int load_requests(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  char line[MAX_REQUEST_SIZE];
+  while (request_count < MAX_REQUESTS && fgets(line, sizeof(line) - 1, f)) {
+    size_t size = strlen(line);
+    while (size && (line[size - 1] == '\n' || line[size - 1] == '\r')) {
+      size--;
+    }
+    if (!size) {
+      continue;
+    }
+    request_t* r = &requests[request_count++];
+    memset(r, 0, sizeof(*r));
+    memcpy(r->text, line, size);
+    r->text[size++] = '\n';
+    r->size = size;
+    const char* id = strstr(r->text, "\"id\":");
+    r->id = id ? strtol(id + 5, NULL, 10) : 0;
+  }
+  fclose(f);
+  return request_count ? 0 : -1;
+}
+
+static void complete_request(avr_t* avr) {
+  const char* id = strstr(response, "\"id\":");
+  if (!id) {
+    // notification: rpc.ready, rpc.events, rpc.subscription
+    return;
+  }
+  if (!in_flight_count) {
+    // unsolicited message
+    return;
+  }
+  in_flight_t done = in_flight[0];
+  memmove(in_flight, in_flight + 1, (--in_flight_count) * sizeof(in_flight_t));
+
+  request_t* r = &requests[done.request];
+  long response_id = strtol(id + 5, NULL, 10);
+
+  r->count++;
+  if (response_id != r->id) {
+    // id 0 parse errors and mismatches: some request bytes never reached the parser
+    r->lost++;
+    dropped_rx_bytes += r->size;
+    return;
+  }
+  if (strstr(response, "\"error\":")) {
+    r->errors++;
+  }
+
+  uint64_t cycles = avr->cycle - done.first_byte_cycle;
+  uint64_t turnaround_cycles = response_first_cycle - done.last_byte_cycle;
+  r->total_cycles += cycles;
+  r->total_turnaround_cycles += turnaround_cycles;
+  if (cycles > r->max_cycles) {
+    r->max_cycles = cycles;
+  }
+  if (turnaround_cycles > r->max_turnaround_cycles) {
+    r->max_turnaround_cycles = turnaround_cycles;
+  }
+}
+
+static void on_uart_output(struct avr_irq_t* irq, uint32_t value, void* param) {
+  (void)irq;
+  avr_t* avr = (avr_t*)param;
+
+  // the frame is matched to a request once complete
+  if (response_size == 0) {
+    response_first_cycle = avr->cycle;
+  }
+
+  if ((char)value == '\n') {
+    response[response_size] = 0;
+    responses++;
+    complete_request(avr);
+    response_size = 0;
+    return;
+  }
+  if (response_size < MAX_RESPONSE_SIZE - 1) {
+    response[response_size++] = (char)value;
+  }
+}
+
+static uint16_t read_word(avr_t* avr, uint32_t addr) {
+  return avr->data[addr] | (avr->data[addr + 1] << 8);
+}
+
+static uint32_t parse_addr(const char* value) {
+  // avr-nm prints data addresses with the 0x800000 offset
+  return strtoul(value, NULL, 16) & 0xFFFF;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-m mcu] [-f freq] [-b baud] [-n repeats] [-d depth] [--timeout-ms ms]\n"
+          "          [--heap-start addr --brkval addr] [--json] firmware.elf request_mix.jsonl\n",
+          name);
+}
+
+int main(int argc, char** argv) {
+  const char* mcu = "atmega328p";
+  unsigned long frequency = 16000000;
+  unsigned long baudrate = 115200;
+  int repeats = 100;
+  int depth = 1;
+  unsigned long timeout_ms = 1000;
+  uint32_t heap_start_addr = 0;
+  uint32_t brkval_addr = 0;
+  int json = 0;
+
+  static struct option options[] = {
+    { "mcu", required_argument, 0, 'm' },
+    { "frequency", required_argument, 0, 'f' },
+    { "baudrate", required_argument, 0, 'b' },
+    { "repeats", required_argument, 0, 'n' },
+    { "depth", required_argument, 0, 'd' },
+    { "timeout-ms", required_argument, 0, 't' },
+    { "heap-start", required_argument, 0, 'H' },
+    { "brkval", required_argument, 0, 'B' },
+    { "json", no_argument, 0, 'j' },
+    { 0, 0, 0, 0 }
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "m:f:b:n:d:t:", options, NULL)) != -1) {
+    switch (opt) {
+      case 'm': mcu = optarg; break;
+      case 'f': frequency = strtoul(optarg, NULL, 10); break;
+      case 'b': baudrate = strtoul(optarg, NULL, 10); break;
+      case 'n': repeats = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 't': timeout_ms = strtoul(optarg, NULL, 10); break;
+      case 'H': heap_start_addr = parse_addr(optarg); break;
+      case 'B': brkval_addr = parse_addr(optarg); break;
+      case 'j': json = 1; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (argc - optind != 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (depth < 1 || depth > MAX_IN_FLIGHT) {
+    fprintf(stderr, "depth must be 1..%d\n", MAX_IN_FLIGHT);
+    return 2;
+  }
+  if (load_requests(argv[optind + 1]) < 0) {
+    fprintf(stderr, "no requests in %s\n", argv[optind + 1]);
+    return 1;
+  }
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if (elf_read_firmware(argv[optind], &firmware) != 0) {
+    fprintf(stderr, "failed to read %s\n", argv[optind]);
+    return 1;
+  }
+
+  avr_t* avr = avr_make_mcu_by_name(mcu);
+  if (!avr) {
+    fprintf(stderr, "unknown mcu %s\n", mcu);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = frequency;
+  avr->log = LOG_WARNING;
+
+  // raw UART, no stdio echo
+  uint32_t flags = 0;
+  avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+  flags &= ~AVR_UART_FLAG_STDIO;
+  avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+  avr_irq_t* uart_output = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT);
+  avr_irq_t* uart_input = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+  avr_irq_register_notify(uart_output, on_uart_output, avr);
+
+  // 8N1: 10 bit times per byte
+  const uint64_t byte_cycles = 10ULL * frequency / baudrate;
+  const uint64_t timeout_cycles = (uint64_t)timeout_ms * frequency / 1000;
+  // let setup() run before the first byte
+  uint64_t next_byte_cycle = frequency / 100;
+
+  const int total_requests = repeats * request_count;
+  int sent_requests = 0;
+  int current = -1;
+  size_t current_pos = 0;
+
+  uint16_t min_sp = 0xFFFF;
+  uint16_t max_brk = 0;
+  uint16_t heap_start = heap_start_addr;
+
+  int state = cpu_Running;
+  while (state != cpu_Done && state != cpu_Crashed) {
+    state = avr_run(avr);
+
+    uint16_t sp = avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+    if (sp < min_sp && avr->cycle > 0) {
+      min_sp = sp;
+    }
+    if (brkval_addr) {
+      uint16_t brk = read_word(avr, brkval_addr);
+      if (brk > max_brk) {
+        max_brk = brk;
+      }
+    }
+
+    // start the next request while the pipeline has room
+    if (current < 0 && sent_requests < total_requests && in_flight_count < depth) {
+      current = sent_requests % request_count;
+      current_pos = 0;
+      in_flight_t* f = &in_flight[in_flight_count++];
+      memset(f, 0, sizeof(*f));
+      f->request = current;
+      if (next_byte_cycle < avr->cycle) {
+        next_byte_cycle = avr->cycle;
+      }
+      f->first_byte_cycle = next_byte_cycle;
+    }
+
+    // one byte per frame time, like a real link
+    if (current >= 0 && avr->cycle >= next_byte_cycle) {
+      request_t* r = &requests[current];
+      avr_raise_irq(uart_input, (uint8_t)r->text[current_pos++]);
+      next_byte_cycle += byte_cycles;
+      if (current_pos == r->size) {
+        // an id 0 error or the timeout may have dropped the request while it was sent,
+        // it is the newest one, so then none is left
+        if (in_flight_count) {
+          in_flight[in_flight_count - 1].last_byte_cycle = avr->cycle;
+        }
+        sent_requests++;
+        current = -1;
+      }
+    }
+
+    // the board never answered the oldest request
+    if (in_flight_count && in_flight[0].last_byte_cycle && avr->cycle - in_flight[0].last_byte_cycle > timeout_cycles) {
+      request_t* r = &requests[in_flight[0].request];
+      r->count++;
+      r->lost++;
+      dropped_rx_bytes += r->size;
+      memmove(in_flight, in_flight + 1, (--in_flight_count) * sizeof(in_flight_t));
+    }
+
+    if (sent_requests == total_requests && !in_flight_count) {
+      break;
+    }
+  }
+
+  if (state == cpu_Crashed) {
+    fprintf(stderr, "firmware crashed at cycle %llu\n", (unsigned long long)avr->cycle);
+  }
+
+  const unsigned long stack_bytes = avr->ramend - min_sp;
+  const unsigned long heap_bytes = (brkval_addr && heap_start && max_brk) ? max_brk - heap_start : 0;
+  const double cycles_per_us = frequency / 1e6;
+
+  if (json) {
+    printf("{\"mcu\": \"%s\", \"frequency\": %lu, \"baudrate\": %lu, \"depth\": %d, \"cycles\": %llu,\n",
+           mcu, frequency, baudrate, depth, (unsigned long long)avr->cycle);
+    printf(" \"peak_stack_bytes\": %lu, \"peak_heap_bytes\": %lu, \"dropped_rx_bytes\": %llu, \"requests\": [\n",
+           stack_bytes, heap_bytes, (unsigned long long)dropped_rx_bytes);
+    for (int i = 0; i < request_count; i++) {
+      request_t* r = &requests[i];
+      uint64_t answered = r->count - r->lost;
+      printf("  {\"id\": %ld, \"size\": %zu, \"count\": %llu, \"errors\": %llu, \"lost\": %llu,"
+             " \"avg_cycles\": %llu, \"max_cycles\": %llu, \"avg_turnaround_cycles\": %llu, \"max_turnaround_cycles\": %llu}%s\n",
+             r->id, r->size, (unsigned long long)r->count, (unsigned long long)r->errors, (unsigned long long)r->lost,
+             (unsigned long long)(answered ? r->total_cycles / answered : 0), (unsigned long long)r->max_cycles,
+             (unsigned long long)(answered ? r->total_turnaround_cycles / answered : 0), (unsigned long long)r->max_turnaround_cycles,
+             i + 1 < request_count ? "," : "");
+    }
+    printf("]}\n");
+  } else {
+    printf("%s @ %lu Hz, %lu baud, depth %d, %llu cycles\n", mcu, frequency, baudrate, depth, (unsigned long long)avr->cycle);
+    printf("%4s %6s %7s %7s %6s %12s %12s %12s %10s\n",
+           "id", "size", "count", "errors", "lost", "avg cycles", "max cycles", "turnaround", "avg us");
+    for (int i = 0; i < request_count; i++) {
+      request_t* r = &requests[i];
+      uint64_t answered = r->count - r->lost;
+      uint64_t avg_cycles = answered ? r->total_cycles / answered : 0;
+      printf("%4ld %6zu %7llu %7llu %6llu %12llu %12llu %12llu %10.1f\n",
+             r->id, r->size, (unsigned long long)r->count, (unsigned long long)r->errors, (unsigned long long)r->lost,
+             (unsigned long long)avg_cycles, (unsigned long long)r->max_cycles,
+             (unsigned long long)(answered ? r->total_turnaround_cycles / answered : 0), avg_cycles / cycles_per_us);
+    }
+    printf("peak stack: %lu B, peak heap: %lu B, free RAM low-water: %ld B, dropped RX: %llu B\n",
+           stack_bytes, heap_bytes, (brkval_addr && max_brk) ? (long)min_sp - (long)max_brk : -1L,
+           (unsigned long long)dropped_rx_bytes);
+  }
+
+  return state == cpu_Crashed ? 1 : 0;
+}
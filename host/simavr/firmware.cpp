@@ -0,0 +1,8 @@
+// board.ino built against the real Arduino AVR core for running under simavr
+
+#include <Arduino.h>
+
+// the Arduino builder generates prototypes for the sketch functions
+void rpc_processor(int request_id, const String& method, const String params[], int params_size);
+
+#include "../../board/board.ino"
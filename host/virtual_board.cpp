@@ -0,0 +1,145 @@
+// Runs board.ino on Linux with Serial exposed on a pseudo-terminal,
+// so the unchanged py-cli client can connect to it:
+//
+//   ./virtual_board /tmp/ttyVBOARD
+//   python3 ./py-cli/cli.py /tmp/ttyVBOARD led_on
+
+#include <Arduino.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// the Arduino builder generates prototypes for the sketch functions
+void rpc_processor(int request_id, const String& method, const String params[], int params_size);
+
+#include "../board/board.ino"
+
+
+HardwareSerial Serial;
+
+static const char* link_path = 0;
+
+
+int HardwareSerial::available() {
+  int size = 0;
+  if (ioctl(fd, FIONREAD, &size) < 0) {
+    return 0;
+  }
+  return size + (peeked >= 0 ? 1 : 0);
+}
+
+int HardwareSerial::read() {
+  if (peeked >= 0) {
+    int c = peeked;
+    peeked = -1;
+    return c;
+  }
+  uint8_t c;
+  return ::read(fd, &c, 1) == 1 ? c : -1;
+}
+
+int HardwareSerial::peek() {
+  if (peeked < 0) {
+    peeked = read();
+  }
+  return peeked;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (n < size) {
+    ssize_t res = ::write(fd, buffer + n, size - n);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    n += res;
+  }
+  return n;
+}
+
+void HardwareSerial::flush() {
+  tcdrain(fd);
+}
+
+void HardwareSerial::wait(unsigned long timeout_us) {
+  if (peeked >= 0) {
+    return;
+  }
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  poll(&pfd, 1, (int)((timeout_us + 999) / 1000));
+}
+
+
+static void cleanup(int) {
+  if (link_path) {
+    unlink(link_path);
+  }
+  _exit(0);
+}
+
+static int open_pty() {
+  int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master_fd < 0 || grantpt(master_fd) < 0 || unlockpt(master_fd) < 0) {
+    perror("failed to open pseudo-terminal");
+    return -1;
+  }
+
+  // raw 8-bit transfer on both sides, like a USB-serial bridge
+  struct termios tio;
+  tcgetattr(master_fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(master_fd, TCSANOW, &tio);
+
+  // keep the slave side open, so the master does not fail with EIO
+  // between client sessions
+  int slave_fd = open(ptsname(master_fd), O_RDWR | O_NOCTTY);
+  if (slave_fd < 0) {
+    perror("failed to open pseudo-terminal slave");
+    return -1;
+  }
+  tcgetattr(slave_fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave_fd, TCSANOW, &tio);
+
+  return master_fd;
+}
+
+int main(int argc, char** argv) {
+  int master_fd = open_pty();
+  if (master_fd < 0) {
+    return 1;
+  }
+  Serial.attach(master_fd);
+
+  // optional stable path to the port
+  if (argc > 1) {
+    link_path = argv[1];
+    unlink(link_path);
+    if (symlink(ptsname(master_fd), link_path) < 0) {
+      perror("failed to create the port link");
+      return 1;
+    }
+    signal(SIGINT, cleanup);
+    signal(SIGTERM, cleanup);
+  }
+
+  printf("%s\n", link_path ? link_path : ptsname(master_fd));
+  fflush(stdout);
+
+  setup();
+  for (;;) {
+    loop();
+    // do not spin while idle, wakes up as soon as RX data arrives
+    if (!Serial.available()) {
+      Serial.wait(1000);
+    }
+  }
+}
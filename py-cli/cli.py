@@ -1,9 +1,12 @@
 from enum import Enum
 
 import argparse
+import json
+import signal
 import sys
+import time
 
-from serial_json_rpc import client
+from serial_json_rpc import bench, client, daemon, diagnostics, metrics
 
 
 class Method(Enum):
@@ -25,29 +28,288 @@ def execute_method(json_rpc_client: client.SerialJsonRpcClient, method: str) ->
         raise Exception(f"unknown method: {method}")
 
 
+def execute_bench(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    mix = [bench.BenchItem(spec) for spec in args.mix.split(",")]
+    link_bench = bench.LinkBench(
+        json_rpc_client, mix, count=args.count, depth=args.depth, batch=args.batch, warmup=args.warmup)
+    result = link_bench.run()
+    if args.json:
+        return json.dumps(result, indent=2)
+    return bench.format_result(result)
+
+
+def execute_stats(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    methods = [method for method in args.methods.split(",") if method]
+    stats = diagnostics.read_board_stats(json_rpc_client, methods, reset=args.reset)
+    if args.json:
+        return json.dumps(stats, indent=2)
+
+    lines = [" ".join(f"{name}={stats[name]}" for name in diagnostics.STATS_SUMMARY_FIELDS[:-1]),
+             f"{'method':24} {'calls':>8} {'errors':>7} {'avg us':>10} {'max us':>10} {'bytes in':>10} {'bytes out':>10}"]
+    for method, method_stats in stats["methods"].items():
+        lines.append(f"{method:24} {method_stats['calls']:8} {method_stats['errors']:7} {method_stats['avg_us']:10.1f} "
+                     f"{method_stats['max_us']:10} {method_stats['bytes_in']:10} {method_stats['bytes_out']:10}")
+    return "\n".join(lines)
+
+
+def execute_memory(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    memory = diagnostics.read_board_memory(json_rpc_client)
+    if args.json:
+        return json.dumps(memory, indent=2)
+
+    def unknown(value):
+        return "n/a" if value is None else value
+
+    return "\n".join([
+        f"rx buffer: {memory['rx_buffer_high_water']}/{memory['buffer_size']} bytes, "
+        f"queue high water {memory['queue_high_water']}",
+        f"documents: capacity {memory['document_capacity_high_water']}, usage {memory['document_usage_high_water']}, "
+        f"allocation failures {memory['allocation_failures']}, overflows {memory['document_overflows']}",
+        f"ram: free {unknown(memory['free_ram'])}, low water {unknown(memory['free_ram_low_water'])}, "
+        f"stack high water {unknown(memory['stack_high_water'])}",
+    ])
+
+
+def execute_rx(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    rx = diagnostics.read_board_rx(json_rpc_client)
+    if args.json:
+        return json.dumps(rx, indent=2)
+    return (f"rx ring: high water {rx['ring_high_water']}/{rx['ring_size']} bytes, "
+            f"full {rx['ring_full']}, serial overruns {rx['serial_overruns']}")
+
+
+def execute_trace(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    records = diagnostics.read_board_trace(json_rpc_client, binary=args.binary, reset=args.reset)
+    if args.json:
+        return json.dumps(records, indent=2)
+
+    def duration(value):
+        return "-" if value is None else value
+
+    lines = [f"{'id':>8} " + " ".join(f"{name[:-3]:>12}" for name in diagnostics.TRACE_DURATIONS) + f" {'total':>12}"]
+    for record in records:
+        lines.append(f"{record['id']:8} " + " ".join(f"{duration(record[name]):>12}" for name in diagnostics.TRACE_DURATIONS)
+                     + f" {duration(record['total_us']):>12}")
+    return "\n".join(lines)
+
+
+def execute_clock(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    clock = json_rpc_client.sync_clock(args.samples)
+    for _ in range(args.syncs - 1):
+        time.sleep(args.interval)
+        clock.sync(args.samples)
+
+    # one-way latencies of the best exchange, board times mapped to the host clock
+    best = clock.history[-1]
+    uplink_sec = clock.to_host_time(best.board_rx_us) - best.host_tx
+    downlink_sec = best.host_rx - clock.to_host_time(best.board_tx_us)
+    result = {
+        "offset": clock.offset, "drift_ppm": clock.drift * 1e6, "error_us": clock.error * 1e6,
+        "round_trip_us": (best.host_rx - best.host_tx) * 1e6, "board_us": best.board_tx_us - best.board_rx_us,
+        "uplink_us": uplink_sec * 1e6, "downlink_us": downlink_sec * 1e6,
+    }
+    if args.json:
+        return json.dumps(result, indent=2)
+    return (f"offset {result['offset']:.6f} s, drift {result['drift_ppm']:.1f} ppm, error +-{result['error_us']:.0f} us\n"
+            f"round trip {result['round_trip_us']:.0f} us: uplink {result['uplink_us']:.0f} us, "
+            f"board {result['board_us']} us, downlink {result['downlink_us']:.0f} us")
+
+
+def execute_subscribe(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    subscription = json_rpc_client.subscribe(args.method, json.loads(args.params), args.period)
+    try:
+        for index, sample in enumerate(subscription):
+            value = sample.result if sample.error is None else f"error {sample.error}"
+            print(f"{sample.board_us:>10} {value}", flush=True)
+            if index + 1 == args.count:
+                break
+    finally:
+        subscription.close()
+    return f"{subscription.received} samples, {subscription.dropped} dropped"
+
+
+def execute_upload(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    with open(args.path, "rb") as f:
+        data = f.read()
+    start_ts = time.time()
+    result = json_rpc_client.call_with_upload(args.method, data, json.loads(args.params), args.chunk_size)
+    return f"{len(data)} bytes in {time.time() - start_ts:.3f} s: {result}"
+
+
+def execute_events(json_rpc_client: client.SerialJsonRpcClient, args: argparse.Namespace) -> str:
+    stream = json_rpc_client.events()
+    deadline_ts = time.time() + args.duration
+    try:
+        while True:
+            remaining_sec = deadline_ts - time.time()
+            if remaining_sec <= 0:
+                break
+            try:
+                event = stream.get(timeout=remaining_sec)
+            except TimeoutError:
+                break
+            print(f"{event.board_us:>10} type {event.type} value {event.value}", flush=True)
+    finally:
+        stream.close()
+    return f"{stream.received} events, {stream.board_dropped} dropped by the board, {stream.dropped} by the client"
+
+
+def execute_daemon(args: argparse.Namespace) -> int:
+    json_rpc_client = client.SerialJsonRpcClient(
+        port=args.port, baudrate=args.baudrate, init_timeout=float(args.init_timeout), attach=args.attach)
+    if args.trace:
+        json_rpc_client.metrics.start_trace(args.trace, f"serial-json-rpc daemon {args.port}")
+    path = args.socket or daemon.socket_path(args.port)
+    json_rpc_daemon = daemon.SerialJsonRpcDaemon(json_rpc_client, path, args.max_in_flight)
+    # unsubscribe and remove the socket on kill too
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+    try:
+        json_rpc_daemon.start()
+        print(f"init: {json_rpc_daemon.ready_params}")
+        print(f"serving {args.port} on {path}, {json_rpc_daemon.max_in_flight} requests in flight", flush=True)
+        json_rpc_daemon.serve_forever()
+        return 0
+    except KeyboardInterrupt:
+        return 0
+    except Exception as ex:
+        print(f"failed to run daemon with: {str(ex)}")
+        return 1
+    finally:
+        if args.metrics:
+            print(metrics.format_summary(json_rpc_client.metrics.summary()))
+        json_rpc_daemon.close()
+
+
+def add_global_arguments(parser: argparse.ArgumentParser, defaults: bool) -> None:
+    # added to every command too, so they can follow it like before the subcommands,
+    # there without defaults so they don't override the ones given before the command
+    def default(value):
+        return value if defaults else argparse.SUPPRESS
+
+    parser.add_argument('--baudrate', type=int, default=default(115200))
+    parser.add_argument('--init-timeout', type=int, default=default(3))
+    parser.add_argument('--attach', action='store_true', default=default(False),
+                        help="don't reset the board on open, ping it instead of waiting for rpc.ready")
+    parser.add_argument('--trace', type=str, default=default(None), help="write every call to this Chrome trace-event JSON file")
+    parser.add_argument('--metrics', action='store_true', default=default(False),
+                        help="print the per-method client latency and bytes")
+    parser.add_argument('--no-daemon', action='store_true', default=default(False),
+                        help="open the port even if a daemon serves it")
+    parser.add_argument('--socket', type=str, default=default(None),
+                        help=f"daemon socket path, default ${daemon.SOCKET_PATH_ENV} or {daemon.socket_path('<port>')}")
+
+
 def cli() -> int:
     parser = argparse.ArgumentParser()
     parser.add_argument('port', type=str)
-    parser.add_argument('--baudrate', type=int, default=115200)
-    parser.add_argument('--init-timeout', type=int, default=3)
-    parser.add_argument('method', type=Method, choices=list(Method))
+    add_global_arguments(parser, defaults=True)
+    subparsers = parser.add_subparsers(dest='command', required=True)
+
+    def add_command(name: str, **kwargs) -> argparse.ArgumentParser:
+        command_parser = subparsers.add_parser(name, **kwargs)
+        add_global_arguments(command_parser, defaults=False)
+        return command_parser
+
+    for method in Method:
+        add_command(str(method))
+    bench_parser = add_command('bench', help="measure the link throughput and latency")
+    bench_parser.add_argument('--mix', type=str, default="led",
+                              help=f"comma-separated request[:payload_size] list, requests: {', '.join(bench.BENCH_REQUESTS)}")
+    bench_parser.add_argument('--count', type=int, default=1000)
+    bench_parser.add_argument('--depth', type=int, default=1, help="requests in flight")
+    bench_parser.add_argument('--batch', type=int, default=1, help="requests per serial write")
+    bench_parser.add_argument('--warmup', type=int, default=10)
+    bench_parser.add_argument('--json', action='store_true')
+    stats_parser = add_command('stats', help="read the board per-method counters")
+    stats_parser.add_argument('--methods', type=str, default="set_builtin_led",
+                              help="comma-separated sketch method names, the board only keeps their hashes")
+    stats_parser.add_argument('--reset', action='store_true', help="clear the counters after reading")
+    stats_parser.add_argument('--json', action='store_true')
+    memory_parser = add_command('memory', help="read the board buffer and RAM high-water marks")
+    memory_parser.add_argument('--json', action='store_true')
+    rx_parser = add_command('rx', help="read the board receive ring high-water mark and overruns")
+    rx_parser.add_argument('--json', action='store_true')
+    trace_parser = add_command('trace', help="read the board per-request stage timestamps, in us")
+    trace_parser.add_argument('--binary', action='store_true', help="read the compact form, fewer round trips")
+    trace_parser.add_argument('--reset', action='store_true', help="clear the ring after reading")
+    trace_parser.add_argument('--json', action='store_true')
+    clock_parser = add_command('clock', help="sync the host and board clocks, split the round trip")
+    clock_parser.add_argument('--samples', type=int, default=8, help="exchanges per sync, the fastest one is kept")
+    clock_parser.add_argument('--syncs', type=int, default=1, help="syncs to estimate the drift from")
+    clock_parser.add_argument('--interval', type=float, default=1.0, help="seconds between syncs")
+    clock_parser.add_argument('--json', action='store_true')
+    subscribe_parser = add_command('subscribe', help="print the results of a method sampled by the board")
+    subscribe_parser.add_argument('method', type=str)
+    subscribe_parser.add_argument('--params', type=str, default="[]", help="JSON array")
+    subscribe_parser.add_argument('--period', type=int, default=100, help="sampling period, ms")
+    subscribe_parser.add_argument('--count', type=int, default=0, help="samples to print, 0 until interrupted")
+    upload_parser = add_command('upload', help="upload a file in chunks and call a method with its handle")
+    upload_parser.add_argument('method', type=str)
+    upload_parser.add_argument('path', type=str)
+    upload_parser.add_argument('--params', type=str, default="[]", help="JSON array, the handle goes after it")
+    upload_parser.add_argument('--chunk-size', type=int, default=client.SerialJsonRpcClient.UPLOAD_CHUNK_SIZE)
+    events_parser = add_command('events', help="print the events queued by push_event() on the board")
+    events_parser.add_argument('--duration', type=float, default=10.0, help="seconds to listen for")
+    daemon_parser = add_command('daemon', help="keep the port open and serve other cli.py runs over a Unix socket")
+    daemon_parser.add_argument('--max-in-flight', type=int, help="requests on the link, default the board queue size")
     args = parser.parse_args()
 
+    if args.command == 'daemon':
+        return execute_daemon(args)
+
     # init
-    json_rpc_client = client.SerialJsonRpcClient(
-        port=args.port, baudrate=args.baudrate, init_timeout=float(args.init_timeout))
+    daemon_path = args.socket or daemon.socket_path(args.port)
+    if not args.no_daemon and daemon.is_running(daemon_path):
+        # no reset, the board stays up between runs
+        json_rpc_client = daemon.DaemonClient(daemon_path, init_timeout=float(args.init_timeout))
+    else:
+        json_rpc_client = client.SerialJsonRpcClient(
+            port=args.port, baudrate=args.baudrate, init_timeout=float(args.init_timeout), attach=args.attach)
+    if args.trace:
+        json_rpc_client.metrics.start_trace(args.trace, f"serial-json-rpc {args.port}")
     init_result = json_rpc_client.init()
     if init_result is not None:
         print(f"init: {init_result}")
 
     # execute
     try:
-        result = execute_method(json_rpc_client, Method(args.method))
-        print(f"{args.method}: {result}")
+        if args.command == 'bench':
+            print(execute_bench(json_rpc_client, args))
+            return 0
+        if args.command == 'stats':
+            print(execute_stats(json_rpc_client, args))
+            return 0
+        if args.command == 'memory':
+            print(execute_memory(json_rpc_client, args))
+            return 0
+        if args.command == 'rx':
+            print(execute_rx(json_rpc_client, args))
+            return 0
+        if args.command == 'trace':
+            print(execute_trace(json_rpc_client, args))
+            return 0
+        if args.command == 'clock':
+            print(execute_clock(json_rpc_client, args))
+            return 0
+        if args.command == 'subscribe':
+            print(execute_subscribe(json_rpc_client, args))
+            return 0
+        if args.command == 'upload':
+            print(execute_upload(json_rpc_client, args))
+            return 0
+        if args.command == 'events':
+            print(execute_events(json_rpc_client, args))
+            return 0
+        result = execute_method(json_rpc_client, Method(args.command))
+        print(f"{args.command}: {result}")
         return 0
     except Exception as ex:
-        print(f"failed to execute {args.method} method with: {str(ex)}")
+        print(f"failed to execute {args.command} method with: {str(ex)}")
         return 1
+    finally:
+        if args.metrics:
+            print(metrics.format_summary(json_rpc_client.metrics.summary()))
+        json_rpc_client.close()
 
 
 if __name__ == '__main__':
@@ -0,0 +1,232 @@
+from typing import Any, Callable, List, Optional
+
+import asyncio
+
+import serial
+
+from .base import JsonRpcClientBase, SerialJsonRpcClientError
+from .framing import FrameAccumulator
+from .subscriptions import Subscription, SubscriptionSample
+
+
+class _SerialProtocol(asyncio.Protocol):
+
+    def __init__(self, client: "AsyncSerialJsonRpcClient"):
+        self.client = client
+
+    def data_received(self, data: bytes) -> None:
+        self.client._data_received(data)
+
+    def connection_lost(self, exc: Optional[Exception]) -> None:
+        self.client._connection_lost(exc)
+
+
+class AsyncSerialJsonRpcClient(JsonRpcClientBase):
+    """
+    asyncio version of `SerialJsonRpcClient` over pyserial-asyncio transports.
+    https://pyserial-asyncio.readthedocs.io/en/latest/
+
+    Requests sent from concurrent tasks are in flight together and matched by id.
+    Clients for different ports share one event loop, so one process can drive all attached boards:
+
+        clients = [AsyncSerialJsonRpcClient(port, 115200, 3.0) for port in ports]
+        await asyncio.gather(*(c.init() for c in clients))
+        await asyncio.gather(*(c.send_request("set_builtin_led", [1]) for c in clients))
+    """
+
+    def __init__(self, port: str, baudrate: int, init_timeout: float,
+                 max_response_size: int = FrameAccumulator.DEFAULT_MAX_FRAME_SIZE, attach: bool = False):
+        super().__init__(port, baudrate, init_timeout, max_response_size, attach)
+        #
+        self.transport = None
+        # resolved with rpc.ready during init
+        self._welcome = None
+        # set when the board credit may allow more requests
+        self._credit_event = asyncio.Event()
+
+    async def init(self) -> Any:
+        """
+        asyncio version of `SerialJsonRpcClient.init()`.
+        """
+        if self.transport is not None:
+            # already initialized
+            return None
+
+        # optional dependency, only the asyncio client needs it
+        import serial_asyncio
+
+        loop = asyncio.get_running_loop()
+        if not self.attach:
+            self._welcome = loop.create_future()
+
+        # initialize serial protocol
+        try:
+            serial_instance = serial.serial_for_url(self.port, baudrate=self.baudrate, do_not_open=True)
+            if self.attach:
+                # applied on open, no DTR pulse to reset the board
+                serial_instance.dtr = False
+                serial_instance.rts = False
+            serial_instance.open()
+            self.transport, _ = await serial_asyncio.connection_for_serial(
+                loop, lambda: _SerialProtocol(self), serial_instance)
+        except Exception as ex:
+            self._welcome = None
+            raise SerialJsonRpcClientError(
+                f"failed to open serial port with {str(ex)}")
+
+        if self.attach:
+            return await self._ping_attached()
+
+        # init: wait for rpc.ready
+        # Arduino auto-resets on every new serial session,
+        # the sketch sends it from init() once the board is up
+        start_ts = loop.time()
+        try:
+            response = await asyncio.wait_for(self._welcome, self.init_timeout)
+            self.metrics.init_wait_sec = loop.time() - start_ts
+        except asyncio.TimeoutError:
+            response = None
+        finally:
+            self._welcome = None
+
+        # can be None
+        return response
+
+    async def _ping_attached(self) -> Any:
+        loop = asyncio.get_running_loop()
+        start_ts = loop.time()
+        deadline_ts = start_ts + max(self.init_timeout, self.ATTACH_PING_INTERVAL_SEC)
+        while True:
+            future = self._write_request("rpc.ping", [])
+            try:
+                result = await asyncio.wait_for(
+                    future, max(0.0, min(self.ATTACH_PING_INTERVAL_SEC, deadline_ts - loop.time())))
+            except asyncio.TimeoutError:
+                self._forget_request(future)
+                if loop.time() >= deadline_ts:
+                    raise SerialJsonRpcClientError(f"failed to attach, no answer to rpc.ping in {self.init_timeout} s")
+                continue
+            except SerialJsonRpcClientError:
+                # rpc.ping needs SERIAL_JSON_RPC_DIAGNOSTICS
+                result = None
+            self.metrics.init_wait_sec = loop.time() - start_ts
+            return result
+
+    async def close(self) -> None:
+        if self.transport is None:
+            return
+
+        # best effort, the board keeps sampling otherwise
+        for subscription in list(self._subscriptions.values()):
+            try:
+                await self.unsubscribe(subscription)
+            except SerialJsonRpcClientError:
+                pass
+
+        self.transport.close()
+        self.transport = None
+        self._fail_pending(SerialJsonRpcClientError("serial protocol closed"))
+        self._close_subscriptions()
+        self.metrics.stop_trace()
+
+    async def send_request(self, method: str, params: Optional[List[Any]], timeout: Optional[float] = None) -> str:
+        """
+        Waits `timeout` s for the response, RESPONSE_READ_TIMEOUT_SEC by default.
+        """
+        if self.transport is None:
+            raise SerialJsonRpcClientError("uninitialized serial protocol")
+
+        loop = asyncio.get_running_loop()
+        start_ts = loop.time()
+
+        # the size with the current id, the sent id can only be longer by a digit
+        await self._wait_credit(len(self._encode_request({
+            "jsonrpc": self.JSON_RPC_VERSION, "id": self.json_rpc_request_id, "method": method, "params": params or []})))
+
+        future = self._write_request(method, params, timeout)
+        try:
+            return await asyncio.wait_for(future, timeout if timeout is not None else self.RESPONSE_READ_TIMEOUT_SEC)
+        except asyncio.TimeoutError:
+            self._forget_request(future, timed_out=True)
+            resp_wait_sec = loop.time() - start_ts
+            raise SerialJsonRpcClientError(
+                f"failed to read response for {method}, resp_wait_sec = {resp_wait_sec}")
+
+    def _write_request(self, method: str, params: Optional[List[Any]], timeout: Optional[float] = None) -> asyncio.Future:
+        future = asyncio.get_running_loop().create_future()
+        request = self._build_request(method, params, timeout)
+        data = self._encode_request(request)
+        self._register_request(request["id"], method, future, len(data))
+
+        # buffered by the transport, the event loop writes it out
+        self.transport.write(data)
+        self.tx_bytes += len(data)
+        return future
+
+    async def upload(self, data: bytes, chunk_size: int = JsonRpcClientBase.UPLOAD_CHUNK_SIZE) -> int:
+        """
+        asyncio version of `SerialJsonRpcClient.upload()`, the chunks go one round trip each.
+        """
+        handle = (await self.send_request("rpc.upload_begin", [len(data)]))[0]
+        for method, params in self._upload_chunk_calls(handle, data, chunk_size):
+            self._check_upload_chunk(params, await self.send_request(method, params))
+        return handle
+
+    async def call_with_upload(self, method: str, data: bytes, params: Optional[List[Any]] = None,
+                               chunk_size: int = JsonRpcClientBase.UPLOAD_CHUNK_SIZE) -> Any:
+        handle = await self.upload(data, chunk_size)
+        return await self.send_request(method, list(params or []) + [handle])
+
+    async def _wait_credit(self, tx_bytes: int) -> None:
+        if self._credit_allows(tx_bytes):
+            return
+        self.credit_waits += 1
+        loop = asyncio.get_running_loop()
+        deadline_ts = loop.time() + self.RESPONSE_READ_TIMEOUT_SEC
+        while not self._credit_allows(tx_bytes):
+            remaining_sec = deadline_ts - loop.time()
+            if remaining_sec <= 0:
+                raise SerialJsonRpcClientError(
+                    f"failed to send request, no board credit for {tx_bytes} bytes in {self.RESPONSE_READ_TIMEOUT_SEC} s")
+            self._credit_event.clear()
+            try:
+                await asyncio.wait_for(self._credit_event.wait(), remaining_sec)
+            except asyncio.TimeoutError:
+                pass
+
+    def _credit_changed(self) -> None:
+        self._credit_event.set()
+
+    async def subscribe(self, method: str, params: Optional[List[Any]], period_ms: int,
+                        callback: Callable[[SubscriptionSample], None]) -> Subscription:
+        """
+        asyncio version of `SerialJsonRpcClient.subscribe()`, samples go to `callback` on the event loop.
+        """
+        response = await self.send_request("rpc.subscribe", [method, params or [], period_ms])
+        subscription = self._open_subscription(response[0], method, params, period_ms)
+        subscription._unsubscribe = self.unsubscribe
+        subscription.set_callback(callback)
+        return subscription
+
+    async def unsubscribe(self, subscription: Subscription) -> None:
+        if self._close_subscription(subscription) and self.transport is not None:
+            await self.send_request("rpc.unsubscribe", [subscription.id])
+
+    def _data_received(self, data: bytes) -> None:
+        self.rx_bytes += len(data)
+        for frame in self._frames.feed(data):
+            if self._welcome is not None and not self._welcome.done():
+                try:
+                    ready, message = self._parse_init_frame(frame)
+                except SerialJsonRpcClientError as ex:
+                    self._welcome.set_exception(ex)
+                    continue
+                if ready:
+                    self._welcome.set_result(message)
+                continue
+            self._dispatch_response(frame)
+
+    def _connection_lost(self, exc: Optional[Exception]) -> None:
+        self.transport = None
+        self._fail_pending(SerialJsonRpcClientError(
+            f"serial connection lost with {str(exc)}" if exc else "serial protocol closed"))
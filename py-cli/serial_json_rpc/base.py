@@ -0,0 +1,357 @@
+from collections import deque
+from typing import Any, Callable, Deque, Dict, List, Optional, Tuple
+
+import json
+import threading
+import time
+
+from .framing import FrameAccumulator
+from .metrics import ClientMetrics
+from .subscriptions import BoardEvent, EventStream, Subscription, SubscriptionSample
+
+
+class SerialJsonRpcClientError(Exception):
+    pass
+
+
+class JsonRpcClientBase:
+    """
+    Request encoding, response parsing and id matching shared by the sync and the asyncio clients.
+    Pending futures only need `done()`, `set_result()` and `set_exception()`.
+    """
+
+    # https://www.jsonrpc.org/specification
+    JSON_RPC_VERSION = "2.0"
+
+    # default of the send_request() `timeout`, long jobs and deferred responses pass their own
+    RESPONSE_READ_TIMEOUT_SEC = 2.0
+
+    # sent by the board init() once it's up
+    READY_NOTIFICATION = "rpc.ready"
+    # rpc.ping period of the attach mode, until the board answers
+    ATTACH_PING_INTERVAL_SEC = 0.25
+
+    # rpc.upload_chunk bytes, the board limit
+    UPLOAD_CHUNK_SIZE = 64
+
+    def __init__(self, port: str, baudrate: int, init_timeout: float,
+                 max_response_size: int = FrameAccumulator.DEFAULT_MAX_FRAME_SIZE, attach: bool = False):
+        self.port = port
+        self.baudrate = baudrate
+        self.init_timeout = init_timeout
+        self.max_response_size = max_response_size
+        # open the port with DTR low so the board doesn't auto-reset, init() pings it then
+        self.attach = attach
+        #
+        # the board answers with id 0 when it can't read the request id,
+        # so real requests start from 1
+        self.json_rpc_request_id = 1
+        #
+        self._pending_lock = threading.Lock()
+        # request id -> (method, future, tx_time, tx_bytes), in the sending order
+        self._pending: Dict[int, Tuple[str, Any, float, int]] = {}
+        # credit flow control, see _credit_allows()
+        # the last "credit":[free_slots, free_bytes] of the board, None until it advertises any
+        self.credit: Optional[Tuple[int, int]] = None
+        # (request id, tx_bytes) sent after the request the credit came with, in the sending order
+        self._credit_after: Deque[Tuple[int, int]] = deque()
+        # sends held back until the board had room
+        self.credit_waits = 0
+        # newline-delimited responses
+        self._frames = FrameAccumulator(max_response_size)
+        # bytes on the wire
+        self.tx_bytes = 0
+        self.rx_bytes = 0
+        # per-method latency histograms and byte counters, optional Chrome trace
+        self.metrics = ClientMetrics()
+        #
+        # notification method -> handler(params, rx_time), called on the reader
+        self._notification_handlers: Dict[str, Callable[[Any, float], None]] = {
+            "rpc.subscription": self._on_subscription_sample,
+            "rpc.events": self._on_events,
+        }
+        # rpc.subscribe id -> samples, added by the reader with the rpc.subscribe response
+        # so no sample is missed before the caller gets the id
+        self._subscriptions: Dict[int, Subscription] = {}
+        # see events()
+        self._event_streams: List[EventStream] = []
+        # id 0 errors that can't be matched to a request, e.g. a request too large for the board buffer
+        self.unsolicited_errors = 0
+        # called with (response, rx_time) on the reader for each of them
+        self.unsolicited_error_handler: Optional[Callable[[Dict[str, Any], float], None]] = None
+
+    def _build_request(self, method: str, params: Optional[List[Any]] = None,
+                       timeout: Optional[float] = None) -> Dict[str, Any]:
+        # `timeout` only goes to a daemon, see DaemonClient
+        request = {
+            "jsonrpc": self.JSON_RPC_VERSION,
+            "id": self.json_rpc_request_id,
+            "method": method,
+        }
+        if params:
+            request["params"] = params
+        else:
+            request["params"] = []
+        self.json_rpc_request_id += 1
+        return request
+
+    def _parse_init_frame(self, frame: bytes) -> Tuple[bool, Any]:
+        """
+        (True, params) for the board rpc.ready notification, (True, result) for the welcome response
+        of sketches without it, (False, None) for anything left from before the reset.
+        """
+        try:
+            message = json.loads(frame)
+        except (UnicodeDecodeError, json.JSONDecodeError):
+            # garbage left from the board reset
+            return False, None
+        if not isinstance(message, dict):
+            return False, None
+        if "id" not in message and "method" in message:
+            if message["method"] == self.READY_NOTIFICATION:
+                return True, message.get("params", None)
+            # notification of a subscription left by a previous session
+            return False, None
+        return True, self._parse_response(message)
+
+    def _encode_request(self, request: Dict[str, Any]) -> bytes:
+        return (json.dumps(request, separators=(',', ':')) + '\n').encode()
+
+    def _register_request(self, request_id: int, method: str, future: Any, tx_bytes: int = 0) -> None:
+        with self._pending_lock:
+            self._pending[request_id] = (method, future, time.time(), tx_bytes)
+            self._credit_after.append((request_id, tx_bytes))
+
+    def _credit_allows(self, tx_bytes: int) -> bool:
+        """
+        True when the board has a free request slot and `tx_bytes` of buffer for one more request.
+        The board credit doesn't cover the requests sent after the one it answered, they are taken off it.
+        With nothing in flight a request is always sent, its response brings fresh credit.
+        """
+        with self._pending_lock:
+            if self.credit is None or not self._pending:
+                return True
+            free_slots, free_bytes = self.credit
+            return (len(self._credit_after) < free_slots
+                    and sum(sent_bytes for _, sent_bytes in self._credit_after) + tx_bytes <= free_bytes)
+
+    def _credit_changed(self) -> None:
+        """
+        Called after a response or a forgotten request, wakes up the senders waiting for credit.
+        """
+        pass
+
+    def _update_credit(self, answered_id: int, credit: Any) -> None:
+        # under _pending_lock
+        if isinstance(credit, list) and len(credit) == 2:
+            self.credit = (int(credit[0]), int(credit[1]))
+        elif self.credit is not None:
+            # the old credit still holds for everything sent after its request
+            return
+        # ids are sent in increasing order
+        while self._credit_after and self._credit_after[0][0] <= answered_id:
+            self._credit_after.popleft()
+
+    def _dispatch_response(self, frame: bytes, rx_time: Optional[float] = None) -> None:
+        frame = frame.strip()
+        if not frame:
+            return
+
+        try:
+            raw_response = json.loads(frame)
+        except (UnicodeDecodeError, json.JSONDecodeError):
+            # not a JSON-RPC message, e.g. a debug print from the sketch
+            return
+        if not isinstance(raw_response, dict):
+            return
+
+        received_time = rx_time if rx_time is not None else time.time()
+        if "id" not in raw_response and "method" in raw_response:
+            self._dispatch_notification(raw_response["method"], raw_response.get("params", None), received_time)
+            return
+
+        request_id = raw_response.get("id", None)
+        with self._pending_lock:
+            if request_id in self._pending:
+                pending_id = request_id
+            elif request_id == 0 and len(self._pending) == 1:
+                # the board failed to read the request id, the only request in flight is the one
+                pending_id = next(iter(self._pending))
+            elif request_id == 0:
+                # jobs and deferred responses answer out of order, so with more in flight
+                # there is no telling whose it is, their own responses or timeouts settle them
+                pending_id = None
+            else:
+                # late response for a timed out request
+                return
+            if pending_id is not None:
+                method, future, tx_time, tx_bytes = self._pending.pop(pending_id)
+                self._update_credit(pending_id, raw_response.get("credit", None))
+        if pending_id is None:
+            self.unsolicited_errors += 1
+            if self.unsolicited_error_handler is not None:
+                self.unsolicited_error_handler(raw_response, received_time)
+            return
+        self._credit_changed()
+
+        try:
+            result = self._parse_response(raw_response)
+        except SerialJsonRpcClientError as ex:
+            result, error = None, ex
+        else:
+            error = None
+        # the terminator is not part of the frame
+        self.metrics.record_call(pending_id, method, tx_time, received_time,
+                                 tx_bytes, len(frame) + 1, str(error) if error is not None else None)
+        if method == "rpc.subscribe" and error is None:
+            with self._pending_lock:
+                self._subscriptions[result[0]] = Subscription(result[0])
+
+        if future.done():
+            # cancelled by the caller
+            return
+        if rx_time is not None:
+            # when the chunk with the response was read, before the caller thread wakes up
+            future.rx_time = rx_time
+            # the whole message, for the daemon to pass on
+            future.raw_response = raw_response
+        if error is not None:
+            future.set_exception(error)
+        else:
+            future.set_result(result)
+
+    def set_notification_handler(self, method: str, handler: Optional[Callable[[Any, float], None]]) -> None:
+        """
+        Calls `handler(params, rx_time)` for every board notification of `method`, on the reader.
+        """
+        if handler is None:
+            self._notification_handlers.pop(method, None)
+        else:
+            self._notification_handlers[method] = handler
+
+    def _dispatch_notification(self, method: str, params: Any, rx_time: float) -> None:
+        handler = self._notification_handlers.get(method, None)
+        if handler is not None:
+            handler(params, rx_time)
+
+    def _on_subscription_sample(self, params: Any, rx_time: float) -> None:
+        if not isinstance(params, dict):
+            return
+        with self._pending_lock:
+            subscription = self._subscriptions.get(params.get("subscription", None), None)
+        if subscription is None:
+            # already unsubscribed
+            return
+        subscription._push(SubscriptionSample(
+            subscription.id, params.get("t", 0) & 0xFFFFFFFF, params.get("result", None), params.get("error", None), rx_time))
+
+    def events(self, callback: Optional[Callable[[BoardEvent], None]] = None,
+               max_queued: int = EventStream.DEFAULT_MAX_QUEUED) -> EventStream:
+        """
+        Board push_event() events from now on, needs SERIAL_JSON_RPC_EVENTS on the board.
+        `callback` gets every event on the reader, without it the events are queued for iteration.
+        """
+        stream = EventStream(max_queued)
+        stream._detach = self._detach_events
+        if callback is not None:
+            stream.set_callback(callback)
+        with self._pending_lock:
+            self._event_streams.append(stream)
+        return stream
+
+    def _detach_events(self, stream: EventStream) -> None:
+        with self._pending_lock:
+            if stream in self._event_streams:
+                self._event_streams.remove(stream)
+
+    def _on_events(self, params: Any, rx_time: float) -> None:
+        if not isinstance(params, dict):
+            return
+        with self._pending_lock:
+            streams = list(self._event_streams)
+        events = [BoardEvent(event[0], event[1], event[2] & 0xFFFFFFFF, rx_time)
+                  for event in params.get("events", []) if isinstance(event, list) and len(event) == 3]
+        for stream in streams:
+            stream.board_dropped += params.get("dropped", 0)
+            for event in events:
+                stream._push(event)
+
+    def _open_subscription(self, subscription_id: int, method: str, params: Optional[List[Any]], period_ms: int) -> Subscription:
+        with self._pending_lock:
+            subscription = self._subscriptions[subscription_id]
+        subscription.method = method
+        subscription.params = params
+        subscription.period_ms = period_ms
+        return subscription
+
+    def _close_subscription(self, subscription: Subscription) -> bool:
+        with self._pending_lock:
+            known = self._subscriptions.pop(subscription.id, None) is not None
+        subscription._close()
+        return known
+
+    def _close_subscriptions(self) -> None:
+        with self._pending_lock:
+            subscriptions = list(self._subscriptions.values())
+            self._subscriptions.clear()
+        for subscription in subscriptions:
+            subscription._close()
+        with self._pending_lock:
+            streams = list(self._event_streams)
+            self._event_streams.clear()
+        for stream in streams:
+            stream._close()
+
+    def _upload_chunk_calls(self, handle: int, data: bytes, chunk_size: int) -> List[Tuple[str, List[Any]]]:
+        if not 0 < chunk_size <= self.UPLOAD_CHUNK_SIZE:
+            raise SerialJsonRpcClientError(f"chunk size must be 1..{self.UPLOAD_CHUNK_SIZE}")
+        return [("rpc.upload_chunk", [handle, offset, list(data[offset:offset + chunk_size])])
+                for offset in range(0, len(data), chunk_size)]
+
+    @staticmethod
+    def _check_upload_chunk(params: List[Any], result: Any) -> None:
+        # [received_size], a board that decoded fewer bytes than sent must not complete the upload
+        _, offset, chunk = params
+        if result != [offset + len(chunk)]:
+            raise SerialJsonRpcClientError(
+                f"rpc.upload_chunk at offset {offset} returned {result}, expected [{offset + len(chunk)}]")
+
+    def _forget_request(self, future: Any, timed_out: bool = False) -> None:
+        with self._pending_lock:
+            for request_id, (method, pending_future, tx_time, tx_bytes) in list(self._pending.items()):
+                if pending_future is future:
+                    del self._pending[request_id]
+                    break
+            else:
+                return
+        self._credit_changed()
+        if timed_out:
+            self.metrics.record_timeout(request_id, method, tx_time, time.time(), tx_bytes)
+
+    def _fail_pending(self, ex: Exception) -> None:
+        with self._pending_lock:
+            pending = list(self._pending.values())
+            self._pending.clear()
+        self._credit_changed()
+        for _, future, _, _ in pending:
+            if not future.done():
+                future.set_exception(ex)
+
+    def _parse_response(self, response: Optional[Dict[str, Any]]) -> Optional[str]:
+        if response is None:
+            return None
+
+        jsonrpc = response.get("jsonrpc", None)
+        if jsonrpc != self.JSON_RPC_VERSION:
+            raise SerialJsonRpcClientError(
+                f"parse error: invalid `jsonrpc` = {jsonrpc}")
+
+        error = response.get("error", None)
+        if error:
+            raise SerialJsonRpcClientError(f"error response: {error}")
+
+        result = response.get("result", None)
+        if result is None:
+            raise SerialJsonRpcClientError(f"parse error: missing `result`")
+
+        return result
@@ -0,0 +1,172 @@
+from collections import deque
+from concurrent.futures import Future, TimeoutError as FutureTimeoutError
+from typing import Any, Callable, Dict, List, Optional, Tuple
+
+import time
+
+from .client import SerialJsonRpcClient, SerialJsonRpcClientError
+from .metrics import nearest_rank
+
+
+# mix item name -> (payload size -> (method, params))
+# rpc.* requests need SERIAL_JSON_RPC_DIAGNOSTICS on the board
+BENCH_REQUESTS: Dict[str, Callable[[int], Tuple[str, List[Any]]]] = {
+    # string result
+    "led": lambda size: ("set_builtin_led", [1]),
+    # minimum round trip
+    "ping": lambda size: ("rpc.ping", []),
+    # string of `size` chars both ways
+    "echo": lambda size: ("rpc.echo", ["x" * size]),
+    # downlink, `size` bytes result
+    "source": lambda size: ("rpc.source", [size]),
+    # uplink, `size` bytes param
+    "sink": lambda size: ("rpc.sink", [[255] * size]),
+}
+
+
+class BenchItem:
+    """
+    One entry of the request mix, `name[:payload_size]`.
+    """
+
+    def __init__(self, spec: str):
+        name, _, size = spec.partition(":")
+        if name not in BENCH_REQUESTS:
+            raise ValueError(f"unknown bench request `{name}`, expected one of {', '.join(BENCH_REQUESTS)}")
+        self.name = spec
+        self.payload_size = int(size) if size else 0
+        self.method, self.params = BENCH_REQUESTS[name](self.payload_size)
+
+
+def percentile(sorted_values: List[float], p: float) -> float:
+    if not sorted_values:
+        return 0.0
+    return sorted_values[nearest_rank(len(sorted_values), p)]
+
+
+def latency_summary(latencies_sec: List[float]) -> Dict[str, float]:
+    values = sorted(latencies_sec)
+    return {
+        "p50_ms": percentile(values, 50) * 1000,
+        "p95_ms": percentile(values, 95) * 1000,
+        "p99_ms": percentile(values, 99) * 1000,
+        "max_ms": (values[-1] if values else 0.0) * 1000,
+    }
+
+
+class LinkBench:
+    """
+    Runs a request mix over `SerialJsonRpcClient` and measures the end-to-end link:
+    requests/s, bytes/s and latency percentiles, overall and per mix item.
+
+    `depth` is the number of requests in flight, `batch` the number of requests per serial write.
+    """
+
+    def __init__(self, client: SerialJsonRpcClient, mix: List[BenchItem], count: int,
+                 depth: int = 1, batch: int = 1, warmup: int = 10):
+        if depth < 1 or batch < 1:
+            raise ValueError("depth and batch must be positive")
+        self.client = client
+        self.mix = mix
+        self.count = count
+        self.depth = depth
+        self.batch = min(batch, depth)
+        self.warmup = warmup
+
+    def run(self) -> Dict[str, Any]:
+        # fill the board and host buffers once, not measured
+        if self.warmup:
+            self._run_requests(self.warmup)
+
+        tx_bytes = self.client.tx_bytes
+        rx_bytes = self.client.rx_bytes
+        start_ts = time.perf_counter()
+        latencies, errors = self._run_requests(self.count)
+        elapsed_sec = time.perf_counter() - start_ts
+        tx_bytes = self.client.tx_bytes - tx_bytes
+        rx_bytes = self.client.rx_bytes - rx_bytes
+
+        all_latencies = [latency for item_latencies in latencies.values() for latency in item_latencies]
+        result = {
+            "config": {
+                "port": self.client.port,
+                "baudrate": self.client.baudrate,
+                "mix": [item.name for item in self.mix],
+                "count": self.count,
+                "depth": self.depth,
+                "batch": self.batch,
+            },
+            "requests": self.count,
+            "errors": sum(errors.values()),
+            "elapsed_sec": elapsed_sec,
+            "requests_per_sec": self.count / elapsed_sec,
+            "tx_bytes": tx_bytes,
+            "rx_bytes": rx_bytes,
+            "tx_bytes_per_sec": tx_bytes / elapsed_sec,
+            "rx_bytes_per_sec": rx_bytes / elapsed_sec,
+            "wire_bytes_per_sec": (tx_bytes + rx_bytes) / elapsed_sec,
+            "latency": latency_summary(all_latencies),
+            "per_request": {
+                name: {"requests": len(item_latencies), "errors": errors[name], "latency": latency_summary(item_latencies)}
+                for name, item_latencies in latencies.items()
+            },
+        }
+        return result
+
+    def _run_requests(self, count: int) -> Tuple[Dict[str, List[float]], Dict[str, int]]:
+        latencies: Dict[str, List[float]] = {item.name: [] for item in self.mix}
+        errors: Dict[str, int] = {item.name: 0 for item in self.mix}
+
+        # (item, send ts, future), oldest first
+        in_flight = deque()
+        sent = 0
+
+        def on_done(item: BenchItem, send_ts: float) -> Callable[[Future], None]:
+            def callback(future: Future) -> None:
+                # errors are counted apart, a fast error response is no latency sample
+                if not future.cancelled() and future.exception() is None:
+                    latencies[item.name].append(time.perf_counter() - send_ts)
+            return callback
+
+        while sent < count or in_flight:
+            # keep the pipeline full
+            while sent < count and len(in_flight) < self.depth:
+                size = min(self.batch, self.depth - len(in_flight), count - sent)
+                items = [self.mix[(sent + i) % len(self.mix)] for i in range(size)]
+                send_ts = time.perf_counter()
+                futures = self.client.send_requests_async([(item.method, item.params) for item in items])
+                for item, future in zip(items, futures):
+                    future.add_done_callback(on_done(item, send_ts))
+                    in_flight.append((item, future))
+                sent += size
+
+            # the board answers in order, wait for the oldest one
+            item, future = in_flight.popleft()
+            try:
+                future.result(timeout=self.client.RESPONSE_READ_TIMEOUT_SEC)
+            except SerialJsonRpcClientError:
+                errors[item.name] += 1
+            except FutureTimeoutError:
+                errors[item.name] += 1
+                self.client._forget_request(future, timed_out=True)
+
+        return latencies, errors
+
+
+def format_result(result: Dict[str, Any]) -> str:
+    config = result["config"]
+    lines = [
+        f"{config['port']} @ {config['baudrate']}, depth {config['depth']}, batch {config['batch']}",
+        f"{result['requests']} requests ({result['errors']} errors) in {result['elapsed_sec']:.3f} s: "
+        f"{result['requests_per_sec']:.1f} req/s, "
+        f"{result['tx_bytes_per_sec']:.0f} B/s up, {result['rx_bytes_per_sec']:.0f} B/s down, "
+        f"{result['wire_bytes_per_sec']:.0f} B/s total",
+        f"{'request':16} {'count':>7} {'errors':>7} {'p50 ms':>8} {'p95 ms':>8} {'p99 ms':>8} {'max ms':>8}",
+    ]
+    rows = list(result["per_request"].items()) + [("all", {
+        "requests": result["requests"], "errors": result["errors"], "latency": result["latency"]})]
+    for name, stats in rows:
+        latency = stats["latency"]
+        lines.append(f"{name:16} {stats['requests']:7} {stats['errors']:7} {latency['p50_ms']:8.2f} "
+                     f"{latency['p95_ms']:8.2f} {latency['p99_ms']:8.2f} {latency['max_ms']:8.2f}")
+    return "\n".join(lines)
@@ -1,131 +1,332 @@
-from typing import Any, Dict, List, Optional, Tuple
+from concurrent.futures import Future, TimeoutError as FutureTimeoutError
+from typing import Any, Callable, List, Optional, Tuple
 
-import json
+import threading
 import time
 
 import serial
 
+from .base import JsonRpcClientBase, SerialJsonRpcClientError
+from .clock import ClockSync
+from .framing import FrameAccumulator
+from .subscriptions import Subscription, SubscriptionSample
 
-class SerialJsonRpcClientError(Exception):
-    pass
 
-
-class SerialJsonRpcClient:
+class SerialJsonRpcClient(JsonRpcClientBase):
     """
     https://pyserial.readthedocs.io/en/latest/pyserial.html
     """
 
-    # https://www.jsonrpc.org/specification
-    JSON_RPC_VERSION = "2.0"
-
-    RESPONSE_READ_TIMEOUT_SEC = 2.0
-
-    def __init__(self, port: str, baudrate: int, init_timeout: float, read_timeout: Optional[float] = None, write_timeout: Optional[float] = None):
-        self.port = port
-        self.baudrate = baudrate
-        self.init_timeout = init_timeout
+    def __init__(self, port: str, baudrate: int, init_timeout: float, read_timeout: Optional[float] = None, write_timeout: Optional[float] = None,
+                 max_response_size: int = FrameAccumulator.DEFAULT_MAX_FRAME_SIZE, attach: bool = False):
+        super().__init__(port, baudrate, init_timeout, max_response_size, attach)
         self.read_timeout = read_timeout
         self.write_timeout = write_timeout
         #
         self.serial = None
-        self.json_rpc_request_id = 0
+        #
+        self._write_lock = threading.Lock()
+        # notified by the reader when the board credit may allow more requests
+        self._credit_cond = threading.Condition()
+        self._reader = None
+        self._closing = threading.Event()
+        # see sync_clock()
+        self.clock = None
 
-    def init(self) -> str:
+    def init(self) -> Any:
+        """
+        Opens the port and returns the rpc.ready params once the board is up, None without it after `init_timeout`.
+        In the attach mode the board keeps running and the rpc.ping result is returned once it answers.
+        """
         if self.serial is not None:
             # already initialized
             return
 
         # initialize serial protocol
         try:
-            self.serial = serial.Serial(
-                port=self.port, baudrate=self.baudrate, timeout=self.read_timeout, write_timeout=self.write_timeout)
+            self.serial = self._open_port()
         except Exception as ex:
             raise SerialJsonRpcClientError(
                 f"failed to open serial port with {str(ex)}")
 
-        # init: read welcome message
-        # Arduino auto-resets on every new serial session
-        # so we need to wait for the full board initialization
-        response, _ = self._read_response(self.init_timeout)
+        response = None
+        if not self.attach:
+            # init: wait for rpc.ready
+            # Arduino auto-resets on every new serial session,
+            # the sketch sends it from init() once the board is up
+            response, self.metrics.init_wait_sec = self._read_ready(self.init_timeout)
+
+        # from now on all responses are read by the background reader
+        self._closing.clear()
+        self._reader = threading.Thread(
+            target=self._reader_loop, name=f"serial-json-rpc-reader-{self.port}", daemon=True)
+        self._reader.start()
+
+        if self.attach:
+            response = self._ping_attached()
 
         # can be None
         return response
 
-    def send_request(self, method: str, params: Optional[List[Any]]) -> str:
+    def _open_port(self) -> Any:
+        port = serial.Serial(
+            port=None, baudrate=self.baudrate, timeout=self.read_timeout, write_timeout=self.write_timeout)
+        port.port = self.port
+        if self.attach:
+            # applied on open, no DTR pulse to reset the board
+            port.dtr = False
+            port.rts = False
+        port.open()
+        return port
+
+    def _ping_attached(self) -> Any:
+        """
+        Pings the board until it answers, an error answer proves it runs too.
+        Pings are repeated in case the open reset the board after all.
+        """
+        start_ts = time.time()
+        deadline_ts = start_ts + max(self.init_timeout, self.ATTACH_PING_INTERVAL_SEC)
+        while True:
+            future = self.send_request_async("rpc.ping", [])
+            try:
+                result = future.result(timeout=max(0.0, min(self.ATTACH_PING_INTERVAL_SEC, deadline_ts - time.time())))
+            except FutureTimeoutError:
+                self._forget_request(future)
+                if time.time() >= deadline_ts:
+                    raise SerialJsonRpcClientError(f"failed to attach, no answer to rpc.ping in {self.init_timeout} s")
+                continue
+            except SerialJsonRpcClientError:
+                # rpc.ping needs SERIAL_JSON_RPC_DIAGNOSTICS
+                result = None
+            self.metrics.init_wait_sec = time.time() - start_ts
+            return result
+
+    def sync_clock(self, samples: int = 8) -> "ClockSync":
+        """
+        Maps the board micros() to the host time.time(), needs SERIAL_JSON_RPC_TIME on the board.
+        Call it again from time to time, the drift is estimated from the syncs history.
+        """
+        if self.clock is None:
+            self.clock = ClockSync(self)
+        self.clock.sync(samples)
+        return self.clock
+
+    def close(self) -> None:
         if self.serial is None:
-            raise SerialJsonRpcClientError("uninitialized serial protocol")
+            return
 
-        request = self._build_request(method, params)
+        # best effort, the board keeps sampling otherwise
+        for subscription in list(self._subscriptions.values()):
+            try:
+                self.unsubscribe(subscription)
+            except SerialJsonRpcClientError:
+                pass
 
-        # send request and read the amount of written bytes
-        w_res = self.serial.write((json.dumps(request, separators=(',', ':')) + '\n').encode())
-        if not w_res:
-            raise SerialJsonRpcClientError(
-                "failed to send request, 0 bytes written")
+        self._closing.set()
+        # wake up the reader blocked in read()
+        if hasattr(self.serial, "cancel_read"):
+            self.serial.cancel_read()
+        if self._reader is not None:
+            self._reader.join(timeout=1.0)
+            self._reader = None
 
-        # flush the data to the board
-        self.serial.flush()
+        self.serial.close()
+        self.serial = None
+        self._fail_pending(SerialJsonRpcClientError("serial protocol closed"))
+        self._close_subscriptions()
+        self.metrics.stop_trace()
 
-        response, resp_wait_sec = self._read_response(self.RESPONSE_READ_TIMEOUT_SEC)
-        if response is None:
+    def send_request(self, method: str, params: Optional[List[Any]], timeout: Optional[float] = None) -> str:
+        """
+        Waits `timeout` s for the response, RESPONSE_READ_TIMEOUT_SEC by default.
+        """
+        start_ts = time.time()
+        future = self.send_request_async(method, params, timeout)
+        try:
+            return future.result(timeout=timeout if timeout is not None else self.RESPONSE_READ_TIMEOUT_SEC)
+        except FutureTimeoutError:
+            self._forget_request(future, timed_out=True)
+            resp_wait_sec = time.time() - start_ts
             raise SerialJsonRpcClientError(
                 f"failed to read response for {method}, resp_wait_sec = {resp_wait_sec}")
 
-        return response
+    def subscribe(self, method: str, params: Optional[List[Any]], period_ms: int,
+                  callback: Optional[Callable[[SubscriptionSample], None]] = None) -> Subscription:
+        """
+        Makes the board call `method` every `period_ms` and push the results, needs SERIAL_JSON_RPC_SUBSCRIPTIONS.
+        `callback` gets every sample on the reader thread, without it the samples are queued for iteration.
+        """
+        response = self.send_request("rpc.subscribe", [method, params or [], period_ms])
+        subscription = self._open_subscription(response[0], method, params, period_ms)
+        subscription._unsubscribe = self.unsubscribe
+        if callback is not None:
+            subscription.set_callback(callback)
+        return subscription
+
+    def unsubscribe(self, subscription: Subscription) -> None:
+        # samples in flight are dropped from now on
+        if self._close_subscription(subscription) and self.serial is not None:
+            self.send_request("rpc.unsubscribe", [subscription.id])
 
-    def _build_request(self, method: str, params: Optional[List[Any]] = None) -> Dict[str, Any]:
-        request = {
-            "jsonrpc": self.JSON_RPC_VERSION,
-            "id": self.json_rpc_request_id,
-            "method": method,
-        }
-        if params:
-            request["params"] = params
+    def upload(self, data: bytes, chunk_size: int = JsonRpcClientBase.UPLOAD_CHUNK_SIZE) -> int:
+        """
+        Stages `data` in the board upload sink with rpc.upload_begin and rpc.upload_chunk calls,
+        needs SERIAL_JSON_RPC_UPLOAD. Returns the handle the target method takes.
+        The chunks are pipelined only when the board advertises credit, else they go one round trip each.
+        """
+        handle = self.send_request("rpc.upload_begin", [len(data)])[0]
+        calls = self._upload_chunk_calls(handle, data, chunk_size)
+        if self.credit is None:
+            # without credit a pipelined chunk may overflow the board buffer
+            for method, params in calls:
+                self._check_upload_chunk(params, self.send_request(method, params))
+            return handle
+        futures = self.send_requests_async(calls)
+        for (_, params), future in zip(calls, futures):
+            try:
+                result = future.result(timeout=self.RESPONSE_READ_TIMEOUT_SEC)
+            except FutureTimeoutError:
+                self._forget_request(future, timed_out=True)
+                raise SerialJsonRpcClientError("failed to read response for rpc.upload_chunk")
+            self._check_upload_chunk(params, result)
+        return handle
+
+    def call_with_upload(self, method: str, data: bytes, params: Optional[List[Any]] = None,
+                         chunk_size: int = JsonRpcClientBase.UPLOAD_CHUNK_SIZE) -> Any:
+        """
+        Uploads `data` and calls `method` with the upload handle after `params`.
+        """
+        handle = self.upload(data, chunk_size)
+        return self.send_request(method, list(params or []) + [handle])
+
+    def send_request_async(self, method: str, params: Optional[List[Any]], timeout: Optional[float] = None) -> Future:
+        """
+        Sends the request without waiting for the response.
+        The future is resolved by the background reader with the response with the same id,
+        so any number of requests can be in flight.
+        `future.tx_time` and `future.rx_time` are the host time.time() of the write and of the response read.
+        The caller times the future out, `timeout` only tells a daemon how long to wait for the board.
+        """
+        return self.send_requests_async([(method, params)], timeout)[0]
+
+    def send_requests_async(self, calls: List[Tuple[str, Optional[List[Any]]]],
+                            timeout: Optional[float] = None) -> List[Future]:
+        """
+        Sends (method, params) requests with as few writes as the board credit allows, one future per request.
+        Blocks while the board has no room for the next request, see SERIAL_JSON_RPC_CREDIT.
+        """
+        if self.serial is None:
+            raise SerialJsonRpcClientError("uninitialized serial protocol")
+
+        futures = []
+        unsent = []
+        data = b""
+
+        # ids must reach the wire in the same order they are allocated
+        with self._write_lock:
+            for method, params in calls:
+                request = self._build_request(method, params, timeout)
+                encoded_request = self._encode_request(request)
+                if not self._credit_allows(len(encoded_request)):
+                    # send what fits, the responses to it bring more credit
+                    if unsent:
+                        self._write_requests(data, unsent)
+                        unsent, data = [], b""
+                    self._wait_credit(len(encoded_request))
+                future = Future()
+                self._register_request(request["id"], method, future, len(encoded_request))
+                futures.append(future)
+                unsent.append(future)
+                data += encoded_request
+
+            self._write_requests(data, unsent)
+
+        return futures
+
+    def _wait_credit(self, tx_bytes: int) -> None:
+        deadline_ts = time.time() + self.RESPONSE_READ_TIMEOUT_SEC
+        self.credit_waits += 1
+        with self._credit_cond:
+            while not self._credit_allows(tx_bytes):
+                remaining_sec = deadline_ts - time.time()
+                if remaining_sec <= 0:
+                    raise SerialJsonRpcClientError(
+                        f"failed to send request, no board credit for {tx_bytes} bytes in {self.RESPONSE_READ_TIMEOUT_SEC} s")
+                self._credit_cond.wait(remaining_sec)
+
+    def _credit_changed(self) -> None:
+        with self._credit_cond:
+            self._credit_cond.notify_all()
+
+    def _write_requests(self, data: bytes, futures: List[Future]) -> None:
+        # send requests and read the amount of written bytes
+        tx_time = time.time()
+        for future in futures:
+            future.tx_time = tx_time
+        try:
+            w_res = self.serial.write(data)
+        except Exception as ex:
+            w_res = None
+            error = SerialJsonRpcClientError(f"failed to send request with {str(ex)}")
         else:
-            request["params"] = []
-        self.json_rpc_request_id += 1
-        return request
+            error = SerialJsonRpcClientError("failed to send request, 0 bytes written")
+        if not w_res:
+            for future in futures:
+                self._forget_request(future)
+            raise error
+        self.tx_bytes += w_res
+
+        # flush the data to the board
+        self.serial.flush()
 
-    def _read_response(self, read_timeout_sec: float) -> Tuple[Optional[str], float]:
+    def _read_ready(self, read_timeout_sec: float) -> Tuple[Any, float]:
         if self.serial is None:
             raise SerialJsonRpcClientError("uninitialized serial protocol")
 
         start_ts = time.time()
         deadline_ts = start_ts + read_timeout_sec
 
-        buffer = b""
-        raw_response = None
+        ready, message = False, None
         resp_wait_sec = read_timeout_sec
 
-        # keep reading until full JSON is received
-        while time.time() < deadline_ts:
-            if self.serial.in_waiting > 0:
-                buffer += self.serial.read(self.serial.in_waiting)
-                try:
-                    raw_response = json.loads(buffer.decode())
-                    resp_wait_sec = time.time() - start_ts
+        port_timeout = self.serial.timeout
+        try:
+            # keep reading until rpc.ready is received
+            while not ready:
+                remaining_sec = deadline_ts - time.time()
+                if remaining_sec <= 0:
                     break
-                except json.JSONDecodeError:
-                    continue
-            time.sleep(0.05)
 
-        return self._parse_response(raw_response), resp_wait_sec
+                # blocks in select() and wakes up as soon as any bytes arrive
+                self.serial.timeout = remaining_sec
+                chunk = self.serial.read(self.serial.in_waiting or 1)
 
-    def _parse_response(self, response: Optional[Dict[str, Any]]) -> Optional[str]:
-        if response is None:
-            return None
-
-        jsonrpc = response.get("jsonrpc", None)
-        if jsonrpc != self.JSON_RPC_VERSION:
-            raise SerialJsonRpcClientError(
-                f"parse error: invalid `jsonrpc` = {jsonrpc}")
+                # each frame is parsed once, when its terminator arrives
+                for frame in self._frames.feed(chunk):
+                    ready, message = self._parse_init_frame(frame)
+                    if ready:
+                        resp_wait_sec = time.time() - start_ts
+                        # nothing is pending yet, so the rest of the complete frames are stale
+                        break
+        finally:
+            self.serial.timeout = port_timeout
 
-        error = response.get("error", None)
-        if error:
-            raise SerialJsonRpcClientError(f"error response: {error}")
+        return message, resp_wait_sec
 
-        result = response.get("result", None)
-        if result is None:
-            raise SerialJsonRpcClientError(f"parse error: missing `result`")
+    def _reader_loop(self) -> None:
+        while not self._closing.is_set():
+            try:
+                # blocks until at least one byte arrives
+                chunk = self.serial.read(self.serial.in_waiting or 1)
+                rx_time = time.time()
+            except Exception as ex:
+                if not self._closing.is_set():
+                    self._fail_pending(SerialJsonRpcClientError(f"failed to read response with {str(ex)}"))
+                return
+            if not chunk:
+                continue
+            self.rx_bytes += len(chunk)
 
-        return result
+            # responses are newline-delimited
+            for frame in self._frames.feed(chunk):
+                self._dispatch_response(frame, rx_time)
@@ -0,0 +1,128 @@
+from concurrent.futures import TimeoutError as FutureTimeoutError
+from typing import Any, List, NamedTuple, Optional
+
+import time
+
+from .base import SerialJsonRpcClientError
+
+
+class ClockSample(NamedTuple):
+    """
+    One rpc.time exchange, host times are time.time(), board times are unwrapped micros().
+    """
+    host_tx: float
+    board_rx_us: int
+    board_tx_us: int
+    host_rx: float
+
+    @property
+    def delay(self) -> float:
+        # round trip without the board processing, seconds
+        return (self.host_rx - self.host_tx) - (self.board_tx_us - self.board_rx_us) / 1e6
+
+    @property
+    def host_mid(self) -> float:
+        return (self.host_tx + self.host_rx) / 2
+
+    @property
+    def board_mid_us(self) -> float:
+        return (self.board_rx_us + self.board_tx_us) / 2
+
+
+class ClockSync:
+    """
+    NTP-style mapping of the board micros() to the host time.time():
+
+        host_time = offset + board_us / 1e6 * (1 + drift)
+
+    Every sync() keeps the exchange with the lowest delay, as its one-way latencies are the most symmetric.
+    The offset comes from the latest kept exchange and the drift from a least-squares fit over all of them,
+    so the drift gets better the longer the syncs span.
+    The error bound is half of the kept delay, USB full-speed bridges give well under a millisecond.
+
+    micros() wraps every ~71.6 minutes, syncs must be closer than that to unwrap it.
+    """
+
+    U32 = 1 << 32
+
+    # best exchanges kept for the drift fit
+    HISTORY_SIZE = 32
+
+    def __init__(self, client: Any):
+        # SerialJsonRpcClient, it sets the tx_time/rx_time of the response futures
+        self.client = client
+        self.history: List[ClockSample] = []
+        #
+        self.offset: Optional[float] = None
+        self.drift = 0.0
+        # last seen raw micros() and its unwrapped value
+        self._raw_us: Optional[int] = None
+        self._unwrapped_us = 0
+
+    def _unwrap(self, raw_us: int) -> int:
+        raw_us &= 0xFFFFFFFF
+        if self._raw_us is None:
+            self._unwrapped_us = raw_us
+        else:
+            # signed, samples within a sync may come slightly out of order
+            delta = ((raw_us - self._raw_us + self.U32 // 2) % self.U32) - self.U32 // 2
+            self._unwrapped_us += delta
+        self._raw_us = raw_us
+        return self._unwrapped_us
+
+    def sample(self) -> ClockSample:
+        future = self.client.send_request_async("rpc.time", [])
+        try:
+            rx_us, tx_us = future.result(timeout=self.client.RESPONSE_READ_TIMEOUT_SEC)
+        except FutureTimeoutError:
+            self.client._forget_request(future, timed_out=True)
+            raise SerialJsonRpcClientError("failed to read response for rpc.time")
+        board_rx_us = self._unwrap(rx_us)
+        board_tx_us = board_rx_us + ((tx_us - rx_us) & 0xFFFFFFFF)
+        self._unwrap(tx_us)
+        # wire-level timestamps, without the thread wake-up latency
+        return ClockSample(future.tx_time, board_rx_us, board_tx_us, getattr(future, "rx_time", time.time()))
+
+    def sync(self, samples: int = 8) -> ClockSample:
+        best = min((self.sample() for _ in range(samples)), key=lambda sample: sample.delay)
+        self.history = (self.history + [best])[-self.HISTORY_SIZE:]
+        self._fit()
+        return best
+
+    def _fit(self) -> None:
+        latest = self.history[-1]
+        if len(self.history) > 1 and self.history[-1].board_mid_us - self.history[0].board_mid_us > 1e6:
+            # host seconds per board second, least squares over the kept exchanges
+            xs = [sample.board_mid_us / 1e6 for sample in self.history]
+            ys = [sample.host_mid for sample in self.history]
+            mean_x = sum(xs) / len(xs)
+            mean_y = sum(ys) / len(ys)
+            slope = sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys)) / sum((x - mean_x) ** 2 for x in xs)
+            self.drift = slope - 1.0
+        # anchored to the latest exchange, the fit only brings the rate
+        self.offset = latest.host_mid - latest.board_mid_us / 1e6 * (1 + self.drift)
+
+    @property
+    def error(self) -> Optional[float]:
+        """
+        Upper bound of the offset error of the latest sync, seconds.
+        """
+        return self.history[-1].delay / 2 if self.history else None
+
+    def to_host_time(self, board_us: int) -> float:
+        """
+        Board micros() (raw, as sent by the board) to host time.time(),
+        must be within ~35 minutes of the latest sync.
+        """
+        if self.offset is None:
+            raise ValueError("clock is not synchronized, call sync() first")
+        delta = ((board_us - self._raw_us + self.U32 // 2) % self.U32) - self.U32 // 2
+        return self.offset + (self._unwrapped_us + delta) / 1e6 * (1 + self.drift)
+
+    def to_board_us(self, host_time: float) -> int:
+        """
+        Host time.time() to the raw board micros().
+        """
+        if self.offset is None:
+            raise ValueError("clock is not synchronized, call sync() first")
+        return int(round((host_time - self.offset) / (1 + self.drift) * 1e6)) & 0xFFFFFFFF
@@ -0,0 +1,413 @@
+from collections import deque
+from concurrent.futures import Future
+from typing import Any, Deque, Dict, List, Optional, Set, Tuple
+
+import json
+import os
+import socket
+import tempfile
+import threading
+import time
+
+from .base import SerialJsonRpcClientError
+from .subscriptions import Subscription
+from .client import SerialJsonRpcClient
+from .framing import FrameAccumulator
+
+
+# https://www.jsonrpc.org/specification#error_object
+PARSE_ERROR = -32700
+INVALID_REQUEST = -32600
+SERVER_ERROR = -32000
+
+# overrides the default socket path for every port
+SOCKET_PATH_ENV = "SERIAL_JSON_RPC_SOCKET"
+
+
+def socket_path(port: str) -> str:
+    """
+    Default daemon socket of a serial port, $SERIAL_JSON_RPC_SOCKET or e.g. /tmp/serial-json-rpc-_dev_ttyACM0.sock
+    """
+    path = os.environ.get(SOCKET_PATH_ENV, "")
+    if path:
+        return path
+    return os.path.join(tempfile.gettempdir(), f"serial-json-rpc-{port.replace(os.sep, '_')}.sock")
+
+
+def is_running(path: str) -> bool:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.settimeout(0.5)
+    try:
+        sock.connect(path)
+    except OSError:
+        return False
+    finally:
+        sock.close()
+    return True
+
+
+def _encode(message: Dict[str, Any]) -> bytes:
+    return (json.dumps(message, separators=(',', ':')) + '\n').encode()
+
+
+class _Connection:
+
+    def __init__(self, sock: socket.socket, name: str):
+        self.sock = sock
+        self.name = name
+        # requests read from the socket, waiting for their turn on the serial link
+        self.requests: Deque[Dict[str, Any]] = deque()
+        # rpc.subscribe ids whose samples go to this connection
+        self.subscriptions: Set[int] = set()
+        self.closed = False
+        # replies come from the serial reader, errors from the connection reader
+        self._send_lock = threading.Lock()
+
+    def send(self, message: Dict[str, Any]) -> None:
+        with self._send_lock:
+            if self.closed:
+                return
+            try:
+                self.sock.sendall(_encode(message))
+            except OSError:
+                # the connection reader sees the close
+                pass
+
+    def send_error(self, request_id: Any, code: int, message: str) -> None:
+        self.send({"jsonrpc": SerialJsonRpcClient.JSON_RPC_VERSION, "id": request_id,
+                   "error": {"code": code, "message": message}})
+
+
+class SerialJsonRpcDaemon:
+    """
+    Owns the serial port and serves JSON-RPC to local clients over a Unix socket, see DaemonClient.
+    Request ids are remapped to the link ids and back, so clients pick theirs freely.
+    Connections are served round-robin, one request each, with at most `max_in_flight` requests on the link,
+    so a client pipelining a long batch doesn't starve the others.
+    Subscription samples go to the connection that subscribed, rpc.events to all of them.
+    The board "credit" is consumed by the daemon client and stripped from the replies.
+    """
+
+    # the link is busy with other clients, so the own timeout of a client usually expires first
+    # a request with a "timeout" member, see DaemonClient, is given that plus this margin
+    RESPONSE_TIMEOUT_SEC = 2.0 * SerialJsonRpcClient.RESPONSE_READ_TIMEOUT_SEC
+
+    def __init__(self, json_rpc_client: SerialJsonRpcClient, path: str, max_in_flight: Optional[int] = None):
+        self.client = json_rpc_client
+        self.path = path
+        self.max_in_flight = max_in_flight
+        # rpc.ready params of the board, passed on to every connection
+        self.ready_params: Any = None
+        #
+        self._cond = threading.Condition()
+        self._closing = threading.Event()
+        self._listener: Optional[socket.socket] = None
+        self._connections: List[_Connection] = []
+        # round-robin position in _connections
+        self._next_index = 0
+        self._connection_count = 0
+        # link future -> (connection, request, deadline)
+        self._in_flight: Dict[Future, Tuple[_Connection, Dict[str, Any], float]] = {}
+        # rpc.subscribe id -> connection
+        self._owners: Dict[int, _Connection] = {}
+        self._scheduler: Optional[threading.Thread] = None
+
+    def start(self) -> None:
+        """
+        Inits the client, binds the socket and starts forwarding, serve_forever() then accepts connections.
+        """
+        if is_running(self.path):
+            raise SerialJsonRpcClientError(f"a daemon is already serving {self.path}")
+        if os.path.exists(self.path):
+            # left by a daemon that died
+            os.unlink(self.path)
+
+        self.ready_params = self.client.init()
+        if self.max_in_flight is None:
+            queue_size = self.ready_params.get("queue_size", None) if isinstance(self.ready_params, dict) else None
+            self.max_in_flight = queue_size or 4
+        self.client.set_notification_handler("rpc.subscription", self._on_subscription_sample)
+        self.client.set_notification_handler("rpc.events", self._on_events)
+
+        self._listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        # same user only, like the serial device, the umask keeps other users out from the bind on
+        umask = os.umask(0o077)
+        try:
+            self._listener.bind(self.path)
+        finally:
+            os.umask(umask)
+        os.chmod(self.path, 0o600)
+        self._listener.listen()
+
+        self._closing.clear()
+        self._scheduler = threading.Thread(target=self._schedule_loop, name="serial-json-rpc-daemon-scheduler", daemon=True)
+        self._scheduler.start()
+
+    def serve_forever(self) -> None:
+        while not self._closing.is_set():
+            try:
+                sock, _ = self._listener.accept()
+            except OSError:
+                # closed
+                return
+            with self._cond:
+                self._connection_count += 1
+                connection = _Connection(sock, f"client-{self._connection_count}")
+                self._connections.append(connection)
+            connection.send({"jsonrpc": SerialJsonRpcClient.JSON_RPC_VERSION, "method": SerialJsonRpcClient.READY_NOTIFICATION,
+                             "params": self.ready_params if self.ready_params is not None else {}})
+            threading.Thread(target=self._connection_loop, args=(connection,),
+                             name=f"serial-json-rpc-daemon-{connection.name}", daemon=True).start()
+
+    def close(self) -> None:
+        self._closing.set()
+        with self._cond:
+            self._cond.notify_all()
+            connections = list(self._connections)
+        if self._listener is not None:
+            self._listener.close()
+            self._listener = None
+            os.unlink(self.path)
+        for connection in connections:
+            self._close_connection(connection)
+        if self._scheduler is not None:
+            self._scheduler.join(timeout=1.0)
+            self._scheduler = None
+        # unsubscribes what is left on the board
+        self.client.close()
+
+    def _connection_loop(self, connection: _Connection) -> None:
+        frames = FrameAccumulator(self.client.max_response_size)
+        try:
+            while True:
+                data = connection.sock.recv(4096)
+                if not data:
+                    break
+                for frame in frames.feed(data):
+                    self._queue_request(connection, frame)
+        except OSError:
+            pass
+        self._drop_connection(connection)
+
+    def _queue_request(self, connection: _Connection, frame: bytes) -> None:
+        try:
+            request = json.loads(frame)
+        except (UnicodeDecodeError, json.JSONDecodeError):
+            connection.send_error(None, PARSE_ERROR, "parse error")
+            return
+        if not isinstance(request, dict) or not isinstance(request.get("method", None), str):
+            connection.send_error(request.get("id", None) if isinstance(request, dict) else None,
+                                  INVALID_REQUEST, "invalid request")
+            return
+        with self._cond:
+            connection.requests.append(request)
+            self._cond.notify()
+
+    def _next_request(self) -> Optional[Tuple[_Connection, Dict[str, Any]]]:
+        # under _cond
+        if len(self._in_flight) >= self.max_in_flight:
+            return None
+        count = len(self._connections)
+        for offset in range(count):
+            index = (self._next_index + offset) % count
+            connection = self._connections[index]
+            if connection.requests:
+                self._next_index = index + 1
+                return connection, connection.requests.popleft()
+        return None
+
+    def _schedule_loop(self) -> None:
+        while not self._closing.is_set():
+            self._expire_requests()
+            with self._cond:
+                next_request = self._next_request()
+                if next_request is None:
+                    # woken up by new requests and responses, expiry is checked at least this often
+                    self._cond.wait(0.1)
+                    continue
+            self._forward(*next_request)
+
+    def _response_timeout(self, request: Dict[str, Any]) -> float:
+        timeout = request.get("timeout", None)
+        if isinstance(timeout, (int, float)) and not isinstance(timeout, bool) and timeout > 0:
+            return timeout + self.RESPONSE_TIMEOUT_SEC
+        return self.RESPONSE_TIMEOUT_SEC
+
+    def _forward(self, connection: _Connection, request: Dict[str, Any]) -> None:
+        try:
+            future = self.client.send_request_async(request["method"], request.get("params", None))
+        except SerialJsonRpcClientError as ex:
+            connection.send_error(request.get("id", None), SERVER_ERROR, str(ex))
+            return
+        with self._cond:
+            self._in_flight[future] = (connection, request, time.time() + self._response_timeout(request))
+        # called right away if the response is already in
+        future.add_done_callback(self._on_response)
+
+    def _expire_requests(self) -> None:
+        now = time.time()
+        with self._cond:
+            expired = [(future, entry) for future, entry in self._in_flight.items() if entry[2] <= now]
+            for future, _ in expired:
+                del self._in_flight[future]
+        for future, (connection, request, _) in expired:
+            self.client._forget_request(future, timed_out=True)
+            connection.send_error(request.get("id", None), SERVER_ERROR,
+                                  f"no response for {request['method']} in {self._response_timeout(request)} s")
+
+    def _on_response(self, future: Future) -> None:
+        # on the client reader, or the scheduler for a failed send
+        with self._cond:
+            entry = self._in_flight.pop(future, None)
+            self._cond.notify()
+        if entry is None:
+            # expired
+            return
+        connection, request, _ = entry
+
+        response = getattr(future, "raw_response", None)
+        if response is None:
+            # failed before the board answered, e.g. the port was closed
+            connection.send_error(request.get("id", None), SERVER_ERROR, str(future.exception()))
+            return
+        response = dict(response)
+        # only meaningful for the link the daemon owns
+        response.pop("credit", None)
+
+        if request["method"] == "rpc.subscribe" and isinstance(response.get("result", None), list):
+            with self._cond:
+                self._owners[response["result"][0]] = connection
+                connection.subscriptions.add(response["result"][0])
+        elif request["method"] == "rpc.unsubscribe" and "result" in response:
+            params = request.get("params", None)
+            if isinstance(params, list) and params:
+                # the board stopped sampling, nothing is left to unsubscribe on disconnect or close
+                self._forget_subscription(params[0])
+
+        # requests without an id are notifications, nothing goes back
+        if "id" in request:
+            response["id"] = request["id"]
+            connection.send(response)
+
+    def _forget_subscription(self, subscription_id: Any) -> Optional[Subscription]:
+        """
+        Drops the subscription from its connection and closes the client one, created for the rpc.subscribe response.
+        Returns it when this call closed it, so only one caller sends rpc.unsubscribe.
+        """
+        with self._cond:
+            owner = self._owners.pop(subscription_id, None)
+            if owner is not None:
+                owner.subscriptions.discard(subscription_id)
+        with self.client._pending_lock:
+            subscription = self.client._subscriptions.get(subscription_id, None)
+        if subscription is None or not self.client._close_subscription(subscription):
+            return None
+        return subscription
+
+    def _drop_connection(self, connection: _Connection) -> None:
+        with self._cond:
+            if connection in self._connections:
+                self._connections.remove(connection)
+            connection.requests.clear()
+            subscription_ids = list(connection.subscriptions)
+        self._close_connection(connection)
+        if self._closing.is_set():
+            return
+        # the board would keep sampling for nobody
+        for subscription_id in subscription_ids:
+            subscription = self._forget_subscription(subscription_id)
+            if subscription is not None:
+                try:
+                    self.client.send_request("rpc.unsubscribe", [subscription.id])
+                except SerialJsonRpcClientError:
+                    pass
+
+    def _close_connection(self, connection: _Connection) -> None:
+        with connection._send_lock:
+            if connection.closed:
+                return
+            connection.closed = True
+        try:
+            connection.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        connection.sock.close()
+
+    def _on_subscription_sample(self, params: Any, rx_time: float) -> None:
+        if not isinstance(params, dict):
+            return
+        with self._cond:
+            owner = self._owners.get(params.get("subscription", None), None)
+        if owner is not None:
+            owner.send({"jsonrpc": SerialJsonRpcClient.JSON_RPC_VERSION, "method": "rpc.subscription", "params": params})
+
+    def _on_events(self, params: Any, rx_time: float) -> None:
+        with self._cond:
+            connections = list(self._connections)
+        for connection in connections:
+            connection.send({"jsonrpc": SerialJsonRpcClient.JSON_RPC_VERSION, "method": "rpc.events", "params": params})
+
+
+class _SocketPort:
+    """
+    The part of serial.Serial the client uses, over the daemon socket.
+    """
+
+    def __init__(self, path: str, timeout: Optional[float]):
+        self.timeout = timeout
+        self._sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self._sock.connect(path)
+
+    @property
+    def in_waiting(self) -> int:
+        # read() returns whatever is there anyway
+        return 0
+
+    def read(self, size: int = 1) -> bytes:
+        # like serial read(in_waiting), what has arrived up to a socket buffer
+        self._sock.settimeout(self.timeout)
+        try:
+            data = self._sock.recv(max(size, 4096))
+        except socket.timeout:
+            return b""
+        if not data:
+            raise SerialJsonRpcClientError("daemon closed the connection")
+        return data
+
+    def write(self, data: bytes) -> int:
+        self._sock.sendall(data)
+        return len(data)
+
+    def flush(self) -> None:
+        pass
+
+    def cancel_read(self) -> None:
+        try:
+            self._sock.shutdown(socket.SHUT_RD)
+        except OSError:
+            pass
+
+    def close(self) -> None:
+        self._sock.close()
+
+
+class DaemonClient(SerialJsonRpcClient):
+    """
+    SerialJsonRpcClient talking to a SerialJsonRpcDaemon instead of the port,
+    init() returns the rpc.ready params the board sent the daemon, with no reset.
+    """
+
+    def __init__(self, path: str, init_timeout: float, read_timeout: Optional[float] = None,
+                 max_response_size: int = FrameAccumulator.DEFAULT_MAX_FRAME_SIZE):
+        super().__init__(path, 0, init_timeout, read_timeout, max_response_size=max_response_size)
+
+    def _open_port(self) -> Any:
+        return _SocketPort(self.port, self.read_timeout)
+
+    def _build_request(self, method: str, params: Optional[List[Any]] = None,
+                       timeout: Optional[float] = None) -> Dict[str, Any]:
+        request = super()._build_request(method, params)
+        if timeout is not None:
+            # the daemon keeps the request that long, only the method and params go to the board
+            request["timeout"] = timeout
+        return request
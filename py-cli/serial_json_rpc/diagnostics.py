@@ -0,0 +1,127 @@
+import struct
+
+from typing import Any, Dict, Iterable, List
+
+from .client import SerialJsonRpcClient
+
+
+# methods answered by the board library itself
+BUILTIN_METHODS = (
+    "rpc.ping", "rpc.echo", "rpc.source", "rpc.sink",
+    "rpc.stats", "rpc.memory", "rpc.trace", "rpc.time",
+    "rpc.subscribe", "rpc.unsubscribe", "rpc.rx",
+    "rpc.upload_begin", "rpc.upload_chunk",
+)
+
+STATS_SUMMARY_FIELDS = ("requests", "parse_errors", "overflows", "invalid_requests", "untracked_calls", "methods")
+STATS_METHOD_FIELDS = ("method_hash", "calls", "errors", "total_us", "max_us", "bytes_in", "bytes_out")
+MEMORY_FIELDS = ("buffer_size", "rx_buffer_high_water", "queue_high_water",
+                 "document_capacity_high_water", "document_usage_high_water", "allocation_failures", "document_overflows",
+                 "free_ram", "free_ram_low_water", "stack_high_water")
+RX_FIELDS = ("ring_size", "ring_high_water", "ring_full", "serial_overruns")
+TRACE_SUMMARY_FIELDS = ("records", "traced_requests")
+TRACE_STAGES = ("first_byte_us", "terminator_us", "parsed_us", "handled_us", "serialized_us", "sent_us")
+# durations between consecutive stages
+TRACE_DURATIONS = ("rx_us", "queue_parse_us", "handler_us", "serialize_us", "flush_us")
+
+# rpc.trace("bin") record, see SerialJsonRpcBoard::_send_trace
+_TRACE_BINARY_RECORD = struct.Struct("<iI5H")
+_TRACE_BINARY_MISSING = 0xFFFF
+
+
+def method_hash(method: str) -> int:
+    """
+    FNV-1a, 32 bit, same as SerialJsonRpcBoard::_method_hash.
+    """
+    value = 2166136261
+    for byte in method.encode():
+        value ^= byte
+        value = (value * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def read_board_stats(client: SerialJsonRpcClient, methods: Iterable[str] = (), reset: bool = False) -> Dict[str, Any]:
+    """
+    Reads the rpc.stats counters, needs SERIAL_JSON_RPC_STATS on the board.
+    The board only keeps method name hashes, `methods` are the names to match them with.
+    """
+    names = {method_hash(name): name for name in list(methods) + list(BUILTIN_METHODS)}
+
+    summary = dict(zip(STATS_SUMMARY_FIELDS, client.send_request("rpc.stats", [])))
+    per_method = {}
+    for index in range(summary["methods"]):
+        stats = dict(zip(STATS_METHOD_FIELDS, client.send_request("rpc.stats", [index])))
+        # longs on the board
+        hash_value = stats.pop("method_hash") & 0xFFFFFFFF
+        stats["avg_us"] = stats["total_us"] / stats["calls"] if stats["calls"] else 0.0
+        per_method[names.get(hash_value, f"0x{hash_value:08x}")] = stats
+    summary["methods"] = per_method
+
+    if reset:
+        client.send_request("rpc.stats", ["reset"])
+
+    return summary
+
+
+def read_board_memory(client: SerialJsonRpcClient) -> Dict[str, Any]:
+    """
+    Reads the rpc.memory high-water marks, needs SERIAL_JSON_RPC_MEMORY_STATS on the board.
+    RAM and stack fields are None where the board can't measure them.
+    """
+    memory = dict(zip(MEMORY_FIELDS, client.send_request("rpc.memory", [])))
+    for name in ("free_ram", "free_ram_low_water", "stack_high_water"):
+        if memory[name] < 0:
+            memory[name] = None
+    return memory
+
+
+def read_board_rx(client: SerialJsonRpcClient) -> Dict[str, Any]:
+    """
+    Reads the rpc.rx receive ring counters, needs SERIAL_JSON_RPC_RX_RING on the board.
+    ring_full counts the fills that left bytes in the Serial buffer, bytes were lost only with serial_overruns.
+    """
+    return dict(zip(RX_FIELDS, client.send_request("rpc.rx", [])))
+
+
+def _trace_durations(record: Dict[str, Any]) -> Dict[str, Any]:
+    """
+    Adds the stage durations, None for the stages the request never reached.
+    """
+    stages = [record[name] for name in TRACE_STAGES]
+    for name, start, end in zip(TRACE_DURATIONS, stages, stages[1:]):
+        record[name] = (end - start) & 0xFFFFFFFF if start is not None and end is not None else None
+    record["total_us"] = (stages[-1] - stages[0]) & 0xFFFFFFFF if stages[-1] is not None else None
+    return record
+
+
+def read_board_trace(client: SerialJsonRpcClient, binary: bool = False, reset: bool = False) -> List[Dict[str, Any]]:
+    """
+    Reads the rpc.trace ring oldest first, needs SERIAL_JSON_RPC_TRACE on the board.
+    Timestamps are the board micros(), `id` joins them with the host side of the call.
+    The binary form takes 3x less requests, but stages longer than 65535 us from the first byte are lost.
+    """
+    summary = dict(zip(TRACE_SUMMARY_FIELDS, client.send_request("rpc.trace", [])))
+    records = []
+    if binary:
+        while len(records) < summary["records"]:
+            data = bytes(client.send_request("rpc.trace", ["bin", len(records)]))
+            for values in _TRACE_BINARY_RECORD.iter_unpack(data):
+                request_id, first_byte_us, *deltas = values
+                record = {"id": request_id, "first_byte_us": first_byte_us}
+                for name, delta in zip(TRACE_STAGES[1:], deltas):
+                    record[name] = None if delta == _TRACE_BINARY_MISSING else (first_byte_us + delta) & 0xFFFFFFFF
+                records.append(record)
+    else:
+        for index in range(summary["records"]):
+            values = client.send_request("rpc.trace", [index])
+            record = {"id": values[0]}
+            # longs on the board, the reached bits start at parsed_us, the receive stages are always set
+            reached = values[len(TRACE_STAGES) + 1] << 2 | 0b11
+            for bit, (name, value) in enumerate(zip(TRACE_STAGES, values[1:])):
+                record[name] = value & 0xFFFFFFFF if reached & (1 << bit) else None
+            records.append(record)
+
+    if reset:
+        client.send_request("rpc.trace", ["reset"])
+
+    return [_trace_durations(record) for record in records]
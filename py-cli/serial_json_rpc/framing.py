@@ -0,0 +1,64 @@
+from typing import List
+
+
+class FrameAccumulator:
+    """
+    Splits the serial byte stream into newline-delimited JSON-RPC frames.
+
+    Every received byte is scanned for the terminator once, so the cost is linear in the response size.
+    Bytes after the last terminator are kept for the next frame.
+    A frame growing over `max_frame_size` is dropped up to its terminator.
+    """
+
+    DEFAULT_MAX_FRAME_SIZE = 64 * 1024
+
+    def __init__(self, max_frame_size: int = DEFAULT_MAX_FRAME_SIZE, terminator: bytes = b"\n"):
+        self.max_frame_size = max_frame_size
+        self.terminator = terminator
+        #
+        self.dropped_frames = 0
+        self._buffer = bytearray()
+        self._discarding = False
+
+    def feed(self, data: bytes) -> List[bytes]:
+        frames = []
+
+        # only the new bytes can contain a terminator
+        scan_pos = len(self._buffer)
+        self._buffer += data
+
+        frame_start = 0
+        while True:
+            frame_end = self._buffer.find(self.terminator, scan_pos)
+            if frame_end < 0:
+                break
+
+            if self._discarding:
+                # tail of an oversized frame
+                self._discarding = False
+            elif frame_end - frame_start > self.max_frame_size:
+                self.dropped_frames += 1
+            else:
+                frames.append(bytes(self._buffer[frame_start:frame_end]))
+
+            frame_start = frame_end + len(self.terminator)
+            scan_pos = frame_start
+
+        # keep the partial frame only
+        if frame_start:
+            del self._buffer[:frame_start]
+
+        if len(self._buffer) > self.max_frame_size:
+            self._buffer.clear()
+            if not self._discarding:
+                self.dropped_frames += 1
+            self._discarding = True
+
+        return frames
+
+    def reset(self) -> None:
+        self._buffer.clear()
+        self._discarding = False
+
+    def __len__(self) -> int:
+        return len(self._buffer)
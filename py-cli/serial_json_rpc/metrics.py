@@ -0,0 +1,227 @@
+from typing import Any, Dict, IO, Optional
+
+import json
+import math
+import os
+import threading
+
+
+def nearest_rank(count: int, p: float) -> int:
+    """
+    0-based index of the `p` percentile in `count` sorted values, nearest-rank method.
+    """
+    # p * count first, so whole ranks stay exact in floating point
+    return max(0, min(count - 1, math.ceil(p * count / 100.0) - 1))
+
+
+class LatencyHistogram:
+    """
+    HDR-style log-linear histogram of integer microseconds.
+    Every power-of-two range is split into 2^(sub_bucket_bits - 1) linear buckets,
+    so any recorded value is reported within 1 / 2^(sub_bucket_bits - 1) of itself
+    (0.8% by default) at a constant memory per range, whatever the spread of the values.
+    """
+
+    def __init__(self, sub_bucket_bits: int = 8):
+        self.sub_bucket_bits = sub_bucket_bits
+        self.sub_bucket_count = 1 << sub_bucket_bits
+        self.sub_bucket_half = self.sub_bucket_count >> 1
+        # bucket index -> count, sparse
+        self.counts: Dict[int, int] = {}
+        self.count = 0
+        self.total = 0
+        self.min: Optional[int] = None
+        self.max: Optional[int] = None
+
+    def _index(self, value: int) -> int:
+        if value < self.sub_bucket_count:
+            return value
+        shift = value.bit_length() - self.sub_bucket_bits
+        return self.sub_bucket_count + (shift - 1) * self.sub_bucket_half + (value >> shift) - self.sub_bucket_half
+
+    def _highest_equivalent(self, index: int) -> int:
+        if index < self.sub_bucket_count:
+            return index
+        shift = (index - self.sub_bucket_count) // self.sub_bucket_half + 1
+        sub_bucket = (index - self.sub_bucket_count) % self.sub_bucket_half + self.sub_bucket_half
+        return ((sub_bucket + 1) << shift) - 1
+
+    def record(self, value: int) -> None:
+        value = max(0, int(value))
+        index = self._index(value)
+        self.counts[index] = self.counts.get(index, 0) + 1
+        self.count += 1
+        self.total += value
+        self.min = value if self.min is None else min(self.min, value)
+        self.max = value if self.max is None else max(self.max, value)
+
+    def merge(self, other: "LatencyHistogram") -> None:
+        if other.sub_bucket_bits != self.sub_bucket_bits:
+            raise ValueError("histograms with different precision")
+        for index, count in other.counts.items():
+            self.counts[index] = self.counts.get(index, 0) + count
+        self.count += other.count
+        self.total += other.total
+        for value in (other.min, other.max):
+            if value is not None:
+                self.min = value if self.min is None else min(self.min, value)
+                self.max = value if self.max is None else max(self.max, value)
+
+    def percentile(self, p: float) -> int:
+        if not self.count:
+            return 0
+        # 1-based, same rank as bench.percentile()
+        rank = nearest_rank(self.count, p) + 1
+        seen = 0
+        for index in sorted(self.counts):
+            seen += self.counts[index]
+            if seen >= rank:
+                # never above the exact max
+                return min(self._highest_equivalent(index), self.max)
+        return self.max
+
+    @property
+    def mean(self) -> float:
+        return self.total / self.count if self.count else 0.0
+
+    def summary(self) -> Dict[str, float]:
+        return {
+            "count": self.count,
+            "mean_ms": self.mean / 1000,
+            "p50_ms": self.percentile(50) / 1000,
+            "p90_ms": self.percentile(90) / 1000,
+            "p99_ms": self.percentile(99) / 1000,
+            "p999_ms": self.percentile(99.9) / 1000,
+            "max_ms": (self.max or 0) / 1000,
+        }
+
+
+class MethodMetrics:
+
+    def __init__(self):
+        self.latency_us = LatencyHistogram()
+        self.calls = 0
+        self.errors = 0
+        self.timeouts = 0
+        self.tx_bytes = 0
+        self.rx_bytes = 0
+
+    def summary(self) -> Dict[str, Any]:
+        return {
+            "calls": self.calls, "errors": self.errors, "timeouts": self.timeouts,
+            "tx_bytes": self.tx_bytes, "rx_bytes": self.rx_bytes,
+            "latency": self.latency_us.summary(),
+        }
+
+
+class ChromeTraceWriter:
+    """
+    Streams calls as Chrome trace events (https://ui.perfetto.dev, chrome://tracing).
+    Every call is an async begin/end pair keyed by the request id, so pipelined calls overlap on one track.
+    The JSON array format stays loadable even if the process dies before close().
+    """
+
+    def __init__(self, path: str, process_name: str):
+        self.path = path
+        self._file: Optional[IO[str]] = open(path, "w")
+        self._pid = os.getpid()
+        self._first = True
+        self._file.write("[\n")
+        self._write({"name": "process_name", "ph": "M", "pid": self._pid, "tid": 0, "args": {"name": process_name}})
+
+    def _write(self, event: Dict[str, Any]) -> None:
+        if self._file is None:
+            return
+        if not self._first:
+            self._file.write(",\n")
+        self._first = False
+        self._file.write(json.dumps(event, separators=(',', ':')))
+
+    def call(self, request_id: int, method: str, start_time: float, end_time: float, args: Dict[str, Any]) -> None:
+        # time.time() in us, same clock as ClockSync.to_host_time()
+        common = {"name": method, "cat": "rpc", "id": request_id, "pid": self._pid, "tid": 0}
+        self._write({**common, "ph": "b", "ts": start_time * 1e6})
+        self._write({**common, "ph": "e", "ts": end_time * 1e6, "args": args})
+
+    def close(self) -> None:
+        if self._file is None:
+            return
+        self._file.write("\n]\n")
+        self._file.close()
+        self._file = None
+
+
+class ClientMetrics:
+    """
+    Per-method latency histograms and byte counters of a client, fed by the response dispatcher.
+    Latency is from the request write to the read of the response, on the client reader thread.
+    """
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self.methods: Dict[str, MethodMetrics] = {}
+        # time to the welcome message in init()
+        self.init_wait_sec: Optional[float] = None
+        self.trace: Optional[ChromeTraceWriter] = None
+
+    def _method(self, method: str) -> MethodMetrics:
+        metrics = self.methods.get(method)
+        if metrics is None:
+            metrics = self.methods[method] = MethodMetrics()
+        return metrics
+
+    def record_call(self, request_id: int, method: str, tx_time: float, rx_time: float,
+                    tx_bytes: int, rx_bytes: int, error: Optional[str] = None) -> None:
+        with self._lock:
+            metrics = self._method(method)
+            metrics.calls += 1
+            metrics.tx_bytes += tx_bytes
+            metrics.rx_bytes += rx_bytes
+            if error is not None:
+                metrics.errors += 1
+            metrics.latency_us.record(round((rx_time - tx_time) * 1e6))
+            if self.trace is not None:
+                args = {"tx_bytes": tx_bytes, "rx_bytes": rx_bytes}
+                if error is not None:
+                    args["error"] = error
+                self.trace.call(request_id, method, tx_time, rx_time, args)
+
+    def record_timeout(self, request_id: int, method: str, tx_time: float, timeout_time: float, tx_bytes: int) -> None:
+        with self._lock:
+            metrics = self._method(method)
+            metrics.calls += 1
+            metrics.timeouts += 1
+            metrics.tx_bytes += tx_bytes
+            if self.trace is not None:
+                self.trace.call(request_id, method, tx_time, timeout_time, {"tx_bytes": tx_bytes, "timeout": True})
+
+    def start_trace(self, path: str, process_name: str) -> None:
+        with self._lock:
+            if self.trace is not None:
+                self.trace.close()
+            self.trace = ChromeTraceWriter(path, process_name)
+
+    def stop_trace(self) -> None:
+        with self._lock:
+            if self.trace is not None:
+                self.trace.close()
+                self.trace = None
+
+    def reset(self) -> None:
+        with self._lock:
+            self.methods = {}
+
+    def summary(self) -> Dict[str, Any]:
+        with self._lock:
+            return {method: metrics.summary() for method, metrics in self.methods.items()}
+
+
+def format_summary(summary: Dict[str, Any]) -> str:
+    lines = [f"{'method':24} {'calls':>7} {'err':>5} {'t/o':>5} {'tx B':>9} {'rx B':>9} "
+             f"{'p50 ms':>8} {'p99 ms':>8} {'max ms':>8}"]
+    for method, metrics in summary.items():
+        latency = metrics["latency"]
+        lines.append(f"{method:24} {metrics['calls']:7} {metrics['errors']:5} {metrics['timeouts']:5} "
+                     f"{metrics['tx_bytes']:9} {metrics['rx_bytes']:9} "
+                     f"{latency['p50_ms']:8.3f} {latency['p99_ms']:8.3f} {latency['max_ms']:8.3f}")
+    return "\n".join(lines)
@@ -0,0 +1,141 @@
+from collections import deque
+from typing import Any, Callable, Dict, Iterator, NamedTuple, Optional
+
+import threading
+
+
+class SubscriptionSample(NamedTuple):
+    subscription: int
+    # board micros() when the sample was taken, see ClockSync.to_host_time()
+    board_us: int
+    # method result, None with an error
+    result: Any
+    error: Optional[Dict[str, Any]]
+    # host time.time() when the notification was read
+    rx_time: float
+
+
+class BoardEvent(NamedTuple):
+    # push_event() type and value
+    type: int
+    value: int
+    # board micros() of push_event(), see ClockSync.to_host_time()
+    board_us: int
+    # host time.time() when the notification was read
+    rx_time: float
+
+
+class SubscriptionClosed(Exception):
+    pass
+
+
+class NotificationQueue:
+    """
+    Items pushed by the board in notifications.
+    With a callback they are passed to it on the client reader thread (the event loop for the asyncio client),
+    otherwise they are queued for `get()` and iteration, the oldest ones are dropped past `max_queued`.
+    """
+
+    DEFAULT_MAX_QUEUED = 1024
+
+    def __init__(self, max_queued: int = DEFAULT_MAX_QUEUED):
+        self.max_queued = max_queued
+        self.received = 0
+        self.dropped = 0
+        self.closed = False
+        # callbacks are called under the lock too, so queued samples are passed on in order
+        self._cond = threading.Condition()
+        self._callback: Optional[Callable[[Any], None]] = None
+        self._samples = deque()
+
+    def _push(self, sample: Any) -> None:
+        with self._cond:
+            self.received += 1
+            if self._callback is not None:
+                self._callback(sample)
+                return
+            if len(self._samples) >= self.max_queued:
+                self._samples.popleft()
+                self.dropped += 1
+            self._samples.append(sample)
+            self._cond.notify()
+
+    def _close(self) -> None:
+        with self._cond:
+            self.closed = True
+            self._cond.notify_all()
+
+    def set_callback(self, callback: Optional[Callable[[Any], None]]) -> None:
+        with self._cond:
+            self._callback = callback
+            if callback is None:
+                return
+            while self._samples:
+                callback(self._samples.popleft())
+
+    def get(self, timeout: Optional[float] = None) -> Any:
+        """
+        Next queued item, raises TimeoutError after `timeout` seconds
+        and SubscriptionClosed once closed and drained.
+        """
+        with self._cond:
+            if not self._cond.wait_for(lambda: self._samples or self.closed, timeout):
+                raise TimeoutError(f"nothing received in {timeout} s")
+            if not self._samples:
+                raise SubscriptionClosed("closed")
+            return self._samples.popleft()
+
+    def __iter__(self) -> Iterator[Any]:
+        while True:
+            try:
+                yield self.get()
+            except SubscriptionClosed:
+                return
+
+
+class Subscription(NotificationQueue):
+    """
+    `SubscriptionSample`s of one rpc.subscribe call, emitted by the board every `period_ms`.
+
+        subscription = client.subscribe("rpc.time", [], period_ms=100)
+        for sample in subscription:
+            print(sample.board_us, sample.result)
+    """
+
+    def __init__(self, subscription_id: int, max_queued: int = NotificationQueue.DEFAULT_MAX_QUEUED):
+        super().__init__(max_queued)
+        self.id = subscription_id
+        self.method: Optional[str] = None
+        self.params = None
+        self.period_ms: Optional[int] = None
+        # set by the client
+        self._unsubscribe: Optional[Callable[["Subscription"], Any]] = None
+
+    def close(self) -> Any:
+        """
+        Unsubscribes on the board, for the asyncio client it returns the coroutine to await.
+        """
+        if self._unsubscribe is not None:
+            return self._unsubscribe(self)
+        self._close()
+
+
+class EventStream(NotificationQueue):
+    """
+    `BoardEvent`s of the rpc.events notifications, queued by push_event() on the board.
+
+        for event in client.events():
+            print(event.type, event.value, event.board_us)
+    """
+
+    def __init__(self, max_queued: int = NotificationQueue.DEFAULT_MAX_QUEUED):
+        super().__init__(max_queued)
+        # events the board ring had no room for
+        self.board_dropped = 0
+        # set by the client
+        self._detach: Optional[Callable[["EventStream"], None]] = None
+
+    def close(self) -> None:
+        if self._detach is not None:
+            self._detach(self)
+        self._close()
@@ -0,0 +1,36 @@
+import unittest
+
+from serial_json_rpc import bench
+from serial_json_rpc.metrics import LatencyHistogram, nearest_rank
+
+
+class NearestRankTest(unittest.TestCase):
+
+    def test_known_values(self):
+        self.assertEqual(bench.percentile([1, 2], 50), 1)
+        self.assertEqual(bench.percentile([1, 2, 3, 4, 5, 6], 50), 3)
+        values = list(range(1, 101))
+        self.assertEqual(bench.percentile(values, 99), 99)
+        self.assertEqual(bench.percentile(values, 100), 100)
+        self.assertEqual(bench.percentile(values, 7), 7)
+        self.assertEqual(bench.percentile(values, 0), 1)
+        self.assertEqual(bench.percentile([5], 99.9), 5)
+        self.assertEqual(bench.percentile([], 50), 0.0)
+
+    def test_rank_bounds(self):
+        for count in range(1, 50):
+            for p in (0, 0.1, 25, 50, 90, 99, 99.9, 100):
+                self.assertTrue(0 <= nearest_rank(count, p) < count)
+
+    def test_histogram_matches_exact(self):
+        # small values are recorded exactly, so the histogram agrees with the sorted list
+        values = list(range(1, 101))
+        histogram = LatencyHistogram()
+        for value in values:
+            histogram.record(value)
+        for p in (1, 50, 90, 99, 99.9, 100):
+            self.assertEqual(histogram.percentile(p), bench.percentile(values, p))
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,66 @@
+import json
+import os
+import subprocess
+import tempfile
+import time
+import unittest
+
+import serial
+
+from serial_json_rpc.bench import BENCH_REQUESTS
+
+# built by `make` in host/, the tests are skipped without it
+VIRTUAL_BOARD = os.path.join(os.path.dirname(__file__), "..", "..", "host", "virtual_board")
+
+
+@unittest.skipUnless(os.path.exists(VIRTUAL_BOARD), "host/virtual_board is not built")
+class VirtualBoardTest(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        path = os.path.join(self.tmp.name, "tty")
+        self.board = subprocess.Popen([VIRTUAL_BOARD, path], stdout=subprocess.DEVNULL)
+        for _ in range(50):
+            if os.path.exists(path):
+                break
+            time.sleep(0.02)
+        self.serial = serial.Serial(path, 115200, timeout=1.0)
+
+    def tearDown(self):
+        self.serial.close()
+        self.board.kill()
+        self.board.wait()
+        self.tmp.cleanup()
+
+    def call(self, request_id, method, params):
+        self.serial.write((json.dumps({"jsonrpc": "2.0", "id": request_id, "method": method, "params": params}, separators=(",", ":")) + "\n").encode())
+        return json.loads(self.serial.readline())
+
+    def test_negative_id_gets_a_response(self):
+        response = self.call(-5, "rpc.ping", [])
+        self.assertEqual(response["id"], -5)
+        self.assertEqual(response["result"], "pong")
+        self.assertIn("credit", response)
+
+    def test_bench_payloads_of_the_advertised_size(self):
+        # README: cli.py bench --mix ping,echo:32,source:64,sink:64
+        for request_id, (name, size, result) in enumerate((
+                ("echo", 32, "x" * 32),
+                ("source", 64, list(range(64))),
+                ("sink", 64, [64])), 1):
+            method, params = BENCH_REQUESTS[name](size)
+            response = self.call(request_id, method, params)
+            self.assertEqual(response.get("result"), result, name)
+
+    def test_subscription_samples_are_notifications(self):
+        subscription = self.call(1, "rpc.subscribe", ["rpc.ping", [], 10])["result"][0]
+        sample = json.loads(self.serial.readline())
+        self.assertNotIn("id", sample)
+        self.assertEqual(sample["method"], "rpc.subscription")
+        self.assertEqual(sample["params"]["subscription"], subscription)
+        self.assertEqual(sample["params"]["result"], "pong")
+        self.assertNotIn("credit", sample)
+
+
+if __name__ == '__main__':
+    unittest.main()